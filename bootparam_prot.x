@@ -56,6 +56,7 @@ const MAX_MACHINE_NAME  = 255;
 const MAX_PATH_LEN	= 1024;
 const MAX_FILEID	= 32;
 const IP_ADDR_TYPE	= 1;
+const MAX_FILEIDS	= 16;
 
 typedef	string	bp_machine_name_t<MAX_MACHINE_NAME>;
 typedef	string	bp_path_t<MAX_PATH_LEN>;
@@ -94,9 +95,36 @@ struct bp_getfile_res {
 	bp_path_t		server_path;
 };
 
+/*
+ * GETFILES (version 2 only) looks up several file identifiers of one
+ * client at once, answering with an entry for each in the same order.
+ * Unlike GETFILE it always answers, with found = FALSE for those that
+ * are not known (all of them if the client is not).
+ */
+struct bp_getfiles_arg {
+	bp_machine_name_t	client_name;
+	bp_fileid_t		file_ids<MAX_FILEIDS>;
+};
+
+union bp_getfiles_ent switch (bool found) {
+	case TRUE:
+		bp_getfile_res	file;
+	case FALSE:
+		void;
+};
+
+struct bp_getfiles_res {
+	bp_getfiles_ent		files<MAX_FILEIDS>;
+};
+
 program BOOTPARAMPROG {
 	version BOOTPARAMVERS {
 		bp_whoami_res	BOOTPARAMPROC_WHOAMI(bp_whoami_arg) = 1;
 		bp_getfile_res	BOOTPARAMPROC_GETFILE(bp_getfile_arg) = 2;
 	} = 1;
+	version BOOTPARAMVERS2 {
+		bp_whoami_res	BOOTPARAMPROC_WHOAMI(bp_whoami_arg) = 1;
+		bp_getfile_res	BOOTPARAMPROC_GETFILE(bp_getfile_arg) = 2;
+		bp_getfiles_res	BOOTPARAMPROC_GETFILES(bp_getfiles_arg) = 3;
+	} = 2;
 } = 100026;
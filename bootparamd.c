@@ -12,273 +12,499 @@ static const char rcsid[] =
   "$FreeBSD$";
 #endif /* not lint */
 
-#ifdef YP
-#include <rpc/rpc.h>
-#include <rpcsvc/yp_prot.h>
-#include <rpcsvc/ypclnt.h>
-#endif
 #include "bootparam_prot.h"
+#include "bootparamd.h"
+#include "bpdb.h"
+#include "bplog.h"
+#include "bpstats.h"
+#include "bptime.h"
+#include "dbwatch.h"
+#include "nis.h"
+#include "rescache.h"
+#include "replycache.h"
 #include <ctype.h>
 #include <err.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-extern int debug, dolog;
-extern in_addr_t route_addr;
-extern char *bootpfile;
+#include <arpa/inet.h>
 
+#ifdef YP
 #define MAXLEN 800
+#endif
 
-struct hostent *he;
-static char buffer[MAXLEN];
-static char hostname[MAX_MACHINE_NAME];
-static char askname[MAX_MACHINE_NAME];
-static char path[MAX_PATH_LEN];
-static char domain_name[MAX_MACHINE_NAME];
+/* reply state for requests dispatched by svc_run() */
+static struct bp_state svc_state;
 
-int getthefile(char *, char *, char *, int);
-int checkhost(char *, char *, int);
+static void logwhoami(in_addr_t, int, bp_whoami_res *, u_int64_t);
+static u_int64_t phasemark(struct bp_state *, int, u_int64_t);
+static int findfile(char *, char *, bp_getfile_res *, char *, char *,
+		    struct bp_state *, u_int64_t *);
+
+/* The rpcgen dispatcher encodes the reply after we return, so
+   PH_ENCODE is not timed for it. */
 
 bp_whoami_res *
 bootparamproc_whoami_1_svc(whoami, req)
 bp_whoami_arg *whoami;
 struct svc_req *req;
 {
-  in_addr_t haddr;
-  static bp_whoami_res res;
-  if (debug)
-    fprintf(stderr,"whoami got question for %d.%d.%d.%d\n",
-	    255 &  whoami->client_address.bp_address_u.ip_addr.net,
-	    255 & whoami->client_address.bp_address_u.ip_addr.host,
-	    255 &  whoami->client_address.bp_address_u.ip_addr.lh,
-	    255 &  whoami->client_address.bp_address_u.ip_addr.impno);
-  if (dolog)
-    syslog(LOG_NOTICE, "whoami got question for %d.%d.%d.%d\n",
-	    255 &  whoami->client_address.bp_address_u.ip_addr.net,
-	    255 & whoami->client_address.bp_address_u.ip_addr.host,
-	    255 &  whoami->client_address.bp_address_u.ip_addr.lh,
-	    255 &  whoami->client_address.bp_address_u.ip_addr.impno);
+  bp_whoami_res *res = bp_whoami(whoami, &svc_state);
 
-  bcopy((char *)&whoami->client_address.bp_address_u.ip_addr, (char *)&haddr,
-	sizeof(haddr));
-  he = gethostbyaddr((char *)&haddr,sizeof(haddr),AF_INET);
-  if ( ! he ) goto failed;
+  if (timephases)
+    bp_phases(BOOTPARAMPROC_WHOAMI, whoami, &svc_state);
+  return(res);
+}
 
-  if (debug) warnx("this is host %s", he->h_name);
-  if (dolog) syslog(LOG_NOTICE,"This is host %s\n", he->h_name);
+bp_getfile_res *
+  bootparamproc_getfile_1_svc(getfile, req)
+bp_getfile_arg *getfile;
+struct svc_req *req;
+{
+  bp_getfile_res *res = bp_getfile(getfile, &svc_state);
 
-  strncpy(askname, he->h_name, sizeof(askname));
-  askname[sizeof(askname)-1] = 0;
+  if (timephases)
+    bp_phases(BOOTPARAMPROC_GETFILE, getfile, &svc_state);
+  return(res);
+}
 
-  if (checkhost(askname, hostname, sizeof hostname) ) {
-    res.client_name = hostname;
-    getdomainname(domain_name, MAX_MACHINE_NAME);
-    res.domain_name = domain_name;
+/* Version 2 has the same WHOAMI and GETFILE, and adds GETFILES. */
 
-    if (  res.router_address.address_type != IP_ADDR_TYPE ) {
-      res.router_address.address_type = IP_ADDR_TYPE;
-      bcopy( &route_addr, &res.router_address.bp_address_u.ip_addr, sizeof(in_addr_t));
-    }
-    if (debug) fprintf(stderr,
-		       "Returning %s   %s    %d.%d.%d.%d\n",
-		       res.client_name,
-		       res.domain_name,
-		       255 &  res.router_address.bp_address_u.ip_addr.net,
-		       255 & res.router_address.bp_address_u.ip_addr.host,
-		       255 &  res.router_address.bp_address_u.ip_addr.lh,
-		       255 & res.router_address.bp_address_u.ip_addr.impno);
-    if (dolog) syslog(LOG_NOTICE,
-		       "Returning %s   %s    %d.%d.%d.%d\n",
-		       res.client_name,
-		       res.domain_name,
-		       255 &  res.router_address.bp_address_u.ip_addr.net,
-		       255 & res.router_address.bp_address_u.ip_addr.host,
-		       255 &  res.router_address.bp_address_u.ip_addr.lh,
-		       255 & res.router_address.bp_address_u.ip_addr.impno);
-
-    return(&res);
+bp_whoami_res *
+bootparamproc_whoami_2_svc(whoami, req)
+bp_whoami_arg *whoami;
+struct svc_req *req;
+{
+  return(bootparamproc_whoami_1_svc(whoami, req));
+}
+
+bp_getfile_res *
+bootparamproc_getfile_2_svc(getfile, req)
+bp_getfile_arg *getfile;
+struct svc_req *req;
+{
+  return(bootparamproc_getfile_1_svc(getfile, req));
+}
+
+bp_getfiles_res *
+bootparamproc_getfiles_2_svc(getfiles, req)
+bp_getfiles_arg *getfiles;
+struct svc_req *req;
+{
+  return(bp_getfiles(getfiles, &svc_state));
+}
+
+/*    bp_whoami and bp_getfile answer a request, building the reply in
+      st, which must not be shared with another request in progress.
+      With timephases, they also leave the time of each phase in st.   */
+
+bp_whoami_res *
+bp_whoami(whoami, st)
+bp_whoami_arg *whoami;
+struct bp_state *st;
+{
+  in_addr_t haddr;
+  u_int64_t start = bptime_usec(), t = start;
+  int found;
+  bp_whoami_res *res = &st->whoami_res;
+
+  if (timephases)
+    phasemark(st, -1, 0);
+  bcopy((char *)&whoami->client_address.bp_address_u.ip_addr, (char *)&haddr,
+	sizeof(haddr));
+  found = checkaddr(haddr, st->hostname, sizeof(st->hostname));
+  if (!found) {
+    /* not a known address, try the name it resolves to */
+    found = !rescache_byaddr(haddr, st->askname, sizeof(st->askname),
+			     &st->expires);
+    if (timephases) t = phasemark(st, PH_CLIENT, t);
+    if (!found) goto failed;
+
+    found = checkhost(st->askname, st->hostname, sizeof(st->hostname));
+    if (timephases) t = phasemark(st, PH_SCAN, t);
+    if (!found) goto failed;
+  } else if (timephases)
+    t = phasemark(st, PH_CLIENT, t);
+
+  res->client_name = st->hostname;
+  getdomainname(st->domain_name, sizeof(st->domain_name));
+  res->domain_name = st->domain_name;
+
+  if (  res->router_address.address_type != IP_ADDR_TYPE ) {
+    res->router_address.address_type = IP_ADDR_TYPE;
+    bcopy( &route_addr, &res->router_address.bp_address_u.ip_addr, sizeof(in_addr_t));
   }
+  bpstats_count(BS_WHOAMI_OK);
+  bpstats_time(BH_WHOAMI, (u_long)(bptime_usec() - start));
+  if (debug || dolog)
+    logwhoami(haddr, BL_OK, res, start);
+  return(res);
+
  failed:
-  if (debug) warnx("whoami failed");
-  if (dolog) syslog(LOG_NOTICE,"whoami failed\n");
+  bpstats_count(BS_WHOAMI_FAILED);
+  bpstats_time(BH_WHOAMI, (u_long)(bptime_usec() - start));
+  if (debug || dolog)
+    logwhoami(haddr, BL_FAILED, NULL, start);
   return(NULL);
 }
 
 
 bp_getfile_res *
-  bootparamproc_getfile_1_svc(getfile, req)
+bp_getfile(getfile, st)
 bp_getfile_arg *getfile;
-struct svc_req *req;
+struct bp_state *st;
 {
-  char *where, *index();
-  static bp_getfile_res res;
+  in_addr_t saddr;
+  u_int64_t start = bptime_usec(), t = start;
+  u_long usec;
+  int found;
+  bp_getfile_res *res = &st->getfile_res;
+
+  if (timephases)
+    phasemark(st, -1, 0);
+  found = !rescache_byname(getfile->client_name, st->askname,
+			   sizeof(st->askname), NULL, &st->expires);
+  if (timephases) t = phasemark(st, PH_CLIENT, t);
+  if (!found)
+    goto failed;
+
+  if (findfile(st->askname, getfile->file_id, res, st->hostname,
+	       st->path, st, &t)) {
+    usec = bptime_usec() - start;
+    bpstats_count(BS_GETFILE_OK);
+    bpstats_time(BH_GETFILE, usec);
+    if (debug || dolog) {
+      bcopy(&res->server_address.bp_address_u.ip_addr, &saddr, 4);
+      bplog_request(BOOTPARAMPROC_GETFILE, BL_OK, getfile->client_name,
+		    getfile->file_id, res->server_name, res->server_path,
+		    saddr, usec);
+    }
+    return(res);
+  }
+  failed:
+  usec = bptime_usec() - start;
+  bpstats_count(BS_GETFILE_FAILED);
+  bpstats_time(BH_GETFILE, usec);
+  if (debug || dolog)
+    bplog_request(BOOTPARAMPROC_GETFILE, BL_FAILED, getfile->client_name,
+		  getfile->file_id, NULL, NULL, 0, usec);
+  return(NULL);
+}
 
-  if (debug)
-    warnx("getfile got question for \"%s\" and file \"%s\"",
-	    getfile->client_name, getfile->file_id);
+/*    bp_getfiles answers a version 2 GETFILES request: each file id
+      gets an entry, found or not.   */
 
-  if (dolog)
-    syslog(LOG_NOTICE,"getfile got question for \"%s\" and file \"%s\"\n",
-	    getfile->client_name, getfile->file_id);
-
-  he = NULL;
-  he = gethostbyname(getfile->client_name);
-  if (! he ) goto failed;
-
-  strncpy(askname, he->h_name, sizeof(askname));
-  askname[sizeof(askname)-1] = 0;
-
-  if (getthefile(askname, getfile->file_id,buffer,sizeof(buffer))) {
-    if ( (where = index(buffer,':')) ) {
-      /* buffer is re-written to contain the name of the info of file */
-      strncpy(hostname, buffer, where - buffer);
-      hostname[where - buffer] = '\0';
-      where++;
-      strcpy(path, where);
-      he = gethostbyname(hostname);
-      if ( !he ) goto failed;
-      bcopy( he->h_addr, &res.server_address.bp_address_u.ip_addr, 4);
-      res.server_name = hostname;
-      res.server_path = path;
-      res.server_address.address_type = IP_ADDR_TYPE;
+bp_getfiles_res *
+bp_getfiles(getfiles, st)
+bp_getfiles_arg *getfiles;
+struct bp_state *st;
+{
+  bp_getfiles_res *res = &st->getfiles_res;
+  bp_getfiles_ent *ent;
+  char *file_id;
+  in_addr_t saddr;
+  u_int64_t start = bptime_usec(), t;
+  u_int i;
+  int known;
+
+  bpstats_count(BS_GETFILES);
+  known = !rescache_byname(getfiles->client_name, st->askname,
+			   sizeof(st->askname), NULL, &st->expires);
+  res->files.files_val = st->files;
+  res->files.files_len = 0;
+  for (i = 0; i < getfiles->file_ids.file_ids_len && i < MAX_FILEIDS; i++) {
+    ent = &st->files[i];
+    file_id = getfiles->file_ids.file_ids_val[i];
+    t = bptime_usec();
+    ent->found = known &&
+      findfile(st->askname, file_id, &ent->bp_getfiles_ent_u.file,
+	       st->fhost[i], st->fpath[i], st, NULL);
+    bpstats_count(ent->found ? BS_GETFILES_FOUND : BS_GETFILES_MISSING);
+    if (debug || dolog) {
+      if (ent->found) {
+	bcopy(&ent->bp_getfiles_ent_u.file.server_address.bp_address_u.ip_addr,
+	      &saddr, 4);
+	bplog_request(BOOTPARAMPROC_GETFILES, BL_OK, getfiles->client_name,
+		      file_id, ent->bp_getfiles_ent_u.file.server_name,
+		      ent->bp_getfiles_ent_u.file.server_path, saddr,
+		      (u_long)(bptime_usec() - t));
+      } else
+	bplog_request(BOOTPARAMPROC_GETFILES, BL_FAILED,
+		      getfiles->client_name, file_id, NULL, NULL, 0,
+		      (u_long)(bptime_usec() - t));
     }
-    else { /* special for dump, answer with null strings */
-      if (!strcmp(getfile->file_id, "dump")) {
-	res.server_name = "";
-	res.server_path = "";
-        res.server_address.address_type = IP_ADDR_TYPE;
-	bzero(&res.server_address.bp_address_u.ip_addr,4);
-      } else goto failed;
+    res->files.files_len++;
+  }
+  bpstats_time(BH_GETFILES, (u_long)(bptime_usec() - start));
+  return(res);
+}
+
+/*    findfile looks up file_id of the client name into res, with the
+      server name and path in host and path (of MAX_MACHINE_NAME + 1
+      and MAX_PATH_LEN + 1 bytes). Returns 0 if the client has no such
+      file or the server cannot be resolved. With timephases and t,
+      the phases are timed into st from *t on.   */
+
+static int
+findfile(name, file_id, res, host, path, st, t)
+char *name;
+char *file_id;
+bp_getfile_res *res;
+char *host;
+char *path;
+struct bp_state *st;
+u_int64_t *t;
+{
+  in_addr_t saddr;
+  int found;
+
+  found = getthefile(name, file_id, host, MAX_MACHINE_NAME + 1,
+		     path, MAX_PATH_LEN + 1);
+  if (timephases && t) *t = phasemark(st, PH_SCAN, *t);
+  if (!found)
+    return(0);
+  if ( *host ) {
+    found = !rescache_byname(host, NULL, 0, &saddr, &st->expires);
+    if (timephases && t) *t = phasemark(st, PH_SERVER, *t);
+    if (!found)
+      return(0);
+    bcopy( &saddr, &res->server_address.bp_address_u.ip_addr, 4);
+    res->server_name = host;
+    res->server_path = path;
+    res->server_address.address_type = IP_ADDR_TYPE;
+  }
+  else { /* special for dump, answer with null strings */
+    if (!strcmp(file_id, "dump")) {
+      res->server_name = "";
+      res->server_path = "";
+      res->server_address.address_type = IP_ADDR_TYPE;
+      bzero(&res->server_address.bp_address_u.ip_addr,4);
+      bpstats_count(BS_GETFILE_DUMP);
+    } else return(0);
+  }
+  return(1);
+}
+
+/*    phasemark records the time since t as that of phase in st, and
+      returns the time now; a phase of -1 marks all phases not reached.   */
+
+static u_int64_t
+phasemark(st, phase, t)
+struct bp_state *st;
+int phase;
+u_int64_t t;
+{
+  u_int64_t now;
+  int i;
+
+  if (phase < 0) {
+    for (i = 0; i < PH_NPHASES; i++)
+      st->phase[i] = PH_NONE;
+    return(0);
+  }
+  now = bptime_usec();
+  st->phase[phase] = (u_long)(now - t);
+  return(now);
+}
+
+/*    bp_phases adds the phase times in st of a request for proc with
+      argument arg to the statistics, and logs them when debugging.   */
+
+void
+bp_phases(proc, arg, st)
+u_int32_t proc;
+void *arg;
+struct bp_state *st;
+{
+  bp_whoami_arg *whoami = arg;
+  bp_getfile_arg *getfile = arg;
+  char client[INET_ADDRSTRLEN];
+
+  if (proc == BOOTPARAMPROC_WHOAMI) {
+    bpstats_phases(BH_WHOAMI, st->phase);
+    if (debug) {
+      inet_ntop(AF_INET, &whoami->client_address.bp_address_u.ip_addr,
+		client, sizeof(client));
+      bplog_phases(proc, client, NULL, st->phase);
     }
+  } else {
+    bpstats_phases(BH_GETFILE, st->phase);
     if (debug)
-      fprintf(stderr, "returning server:%s path:%s address: %d.%d.%d.%d\n",
-	     res.server_name, res.server_path,
-	     255 &  res.server_address.bp_address_u.ip_addr.net,
-	     255 & res.server_address.bp_address_u.ip_addr.host,
-	     255 &  res.server_address.bp_address_u.ip_addr.lh,
-	     255 & res.server_address.bp_address_u.ip_addr.impno);
-    if (dolog)
-      syslog(LOG_NOTICE, "returning server:%s path:%s address: %d.%d.%d.%d\n",
-	     res.server_name, res.server_path,
-	     255 &  res.server_address.bp_address_u.ip_addr.net,
-	     255 & res.server_address.bp_address_u.ip_addr.host,
-	     255 &  res.server_address.bp_address_u.ip_addr.lh,
-	     255 & res.server_address.bp_address_u.ip_addr.impno);
-    return(&res);
+      bplog_phases(proc, getfile->client_name, getfile->file_id, st->phase);
   }
-  failed:
-  if (debug) warnx("getfile failed for %s", getfile->client_name);
-  if (dolog) syslog(LOG_NOTICE,
-		    "getfile failed for %s\n", getfile->client_name);
-  return(NULL);
 }
 
-/*    getthefile return 1 and fills the buffer with the information
-      of the file, e g "host:/export/root/client" if it can be found.
-      If the host is in the database, but the file is not, the buffer
-      will be empty. (This makes it possible to give the special
-      empty answer for the file "dump")   */
+/*    logwhoami passes a whoami request from haddr, begun at start,
+      to the request log.   */
+
+static void
+logwhoami(haddr, result, res, start)
+in_addr_t haddr;
+int result;
+bp_whoami_res *res;
+u_int64_t start;
+{
+  char client[INET_ADDRSTRLEN];
+  in_addr_t raddr = 0;
+
+  inet_ntop(AF_INET, &haddr, client, sizeof(client));
+  if (res != NULL)
+    bcopy(&res->router_address.bp_address_u.ip_addr, &raddr, 4);
+  bplog_request(BOOTPARAMPROC_WHOAMI, result, client, NULL,
+		res ? res->client_name : NULL, res ? res->domain_name : NULL,
+		raddr, (u_long)(bptime_usec() - start));
+}
+
+/*    loaddb reads the database from bootpfile and publishes it for
+      new requests; requests in progress keep the one they started
+      with. If the file cannot be read, the error is logged and the
+      previous database (if any) stays in use.   */
 
 int
-getthefile(askname,fileid,buffer,blen)
-char *askname;
-char *fileid, *buffer;
-int blen;
+loaddb()
 {
-  FILE *bpf;
-  char  *where;
+  struct bpdb *ndb;
+  char errbuf[256];
+
+  if ((ndb = bpdb_load(bootpfile, BPDB_NIS, errbuf, sizeof(errbuf))) == NULL) {
+    warnx("%s", errbuf);
+    if (dolog) syslog(LOG_ERR, "%s, keeping previous database\n", errbuf);
+    return(-1);
+  }
+  if (replycache_stats.hits + replycache_stats.misses) {
+    /* the cached replies are now stale; log the totals so far */
+    if (debug) warnx("reply cache: %lu hits, %lu misses (%lu%%)",
+		     replycache_stats.hits, replycache_stats.misses,
+		     100 * replycache_stats.hits /
+		     (replycache_stats.hits + replycache_stats.misses));
+    if (dolog) syslog(LOG_NOTICE, "reply cache: %lu hits, %lu misses\n",
+		      replycache_stats.hits, replycache_stats.misses);
+  }
+  if (debug) warnx("loaded %u entries from %s", ndb->nent, bootpfile);
+  if (dolog)
+    syslog(LOG_NOTICE, "loaded %u entries from %s\n", ndb->nent, bootpfile);
 #ifdef YP
-  static char *result;
-  int resultlen;
-  static char *yp_domain;
+  if (ndb->nis != BPDB_NONE) {
+    if (!ndb->nismap) {
+      if (debug) warnx("cannot read the NIS map, looking up each host");
+      if (dolog) syslog(LOG_NOTICE,
+			"cannot read the NIS map, looking up each host\n");
+    }
+    /* read the map again from time to time */
+    dbwatch_refresh(nisrefresh);
+  } else
+    dbwatch_refresh(0);
 #endif
+  bpdb_publish(ndb);
+  return(0);
+}
 
-  int ch, pch, fid_len, res = 0;
-  int match = 0;
-  char info[MAX_FILEID + MAX_PATH_LEN+MAX_MACHINE_NAME + 3];
-
-  bpf = fopen(bootpfile, "r");
-  if ( ! bpf )
-    errx(1, "no %s", bootpfile);
-
-  /* XXX see comment below */
-  while ( fscanf(bpf, "%255s", hostname) > 0  && !match ) {
-    if ( *hostname != '#' ) { /* comment */
-      if ( ! strcmp(hostname, askname) ) {
-	match = 1;
-      } else {
-	he = gethostbyname(hostname);
-	if (he && !strcmp(he->h_name, askname)) match = 1;
-      }
-    }
-    if (*hostname == '+' ) { /* NIS */
+/*    compiledb loads the bootparams file in and writes it to out as a
+      snapshot, which loaddb can map without parsing it. Returns the
+      exit status for bootparamd -C.   */
+
+int
+compiledb(in, out)
+char *in, *out;
+{
+  struct bpdb *db;
+  char errbuf[256];
+
+  if ((db = bpdb_load(in, 0, errbuf, sizeof(errbuf))) == NULL ||
+      bpdb_write(db, out, errbuf, sizeof(errbuf))) {
+    warnx("%s", errbuf);
+    bpdb_free(db);
+    return(1);
+  }
+  if (debug) warnx("wrote %u entries to %s", db->nent, out);
+  bpdb_free(db);
+  return(0);
+}
+
+/*    findhost returns the index of the first entry in the database
+      for which askname is a valid name, either literally or as the
+      canonical name of the entry. If the NIS line is reached first
+      and the NIS map has not been loaded in its place, BPDB_NONE is
+      returned and *nis is set.   */
+
+static u_int32_t
+findhost(db, askname, nis)
+const struct bpdb *db;
+char *askname;
+int *nis;
+{
+  u_int32_t match, alias;
+
+  match = bpdb_lookup(db, askname);
+  alias = bpdb_lookup_alias(db, askname);
+  if (alias < match)
+    match = alias;
+  /* BPDB_NONE compares greater than any entry */
+  *nis = (match >= db->nis && db->nis != BPDB_NONE && !db->nismap);
+  return(*nis ? BPDB_NONE : match);
+}
+
+/*    getthefile returns 1 and fills server and path with the location
+      of the file, e g "host" and "/export/root/client", if it can be
+      found. If the host is in the database, but the file is not (or
+      has no server part), server will be empty. (This makes it
+      possible to give the special empty answer for the file "dump")   */
+
+int
+getthefile(askname,fileid,server,slen,path,plen)
+char *askname;
+char *fileid;
+char *server, *path;
+int slen, plen;
+{
+  struct bpdb *db;
+  const struct bpdb_file *f;
+  u_int32_t i;
+  int nis;
 #ifdef YP
-      if (yp_get_default_domain(&yp_domain)) {
-	 if (debug) warn("NIS");
-	 return(0);
-      }
-      if (yp_match(yp_domain, "bootparams", askname, strlen(askname),
-		&result, &resultlen))
-	return (0);
-      if (strstr(result, fileid) == NULL) {
-	buffer[0] = '\0';
-      } else {
-	snprintf(buffer, blen,
-		"%s",strchr(strstr(result,fileid), '=') + 1);
-	if (strchr(buffer, ' ') != NULL)
-	  *(char *)(strchr(buffer, ' ')) = '\0';
-      }
-      if (fclose(bpf))
-        warnx("could not close %s", bootpfile);
-      return(1);
-#else
-      return(0);	/* ENOTSUP */
+  char result[NIS_MAXVAL + 1], *where;
+  char buffer[MAXLEN];
 #endif
+
+  *server = '\0';
+  db = bpdb_acquire();
+  i = findhost(db, askname, &nis);
+  if (i != BPDB_NONE) {
+    if ((f = bpdb_getfile(db, i, fileid)) != NULL &&
+	f->server != BPDB_NONE) {
+      snprintf(server, slen, "%s", bpdb_str(db, f->server));
+      snprintf(path, plen, "%s", bpdb_str(db, f->path));
     }
-    /* skip to next entry */
-    if ( match ) break;
-    pch = ch = getc(bpf);
-    while ( ! ( ch == '\n' && pch != '\\') && ch != EOF) {
-      pch = ch; ch = getc(bpf);
-    }
+    bpdb_release(db);
+    return(1);
   }
-
-  /* if match is true we read the rest of the line to get the
-     info of the file */
-
-  if (match) {
-    fid_len = strlen(fileid);
-    while ( ! res && (fscanf(bpf,"%s", info)) > 0) { /* read a string */
-      ch = getc(bpf);                                /* and a character */
-      if ( *info != '#' ) {                          /* Comment ? */
-	if (! strncmp(info, fileid, fid_len) && *(info + fid_len) == '=') {
-	  where = info + fid_len + 1;
-	  if ( isprint( *where )) {
-	    strcpy(buffer, where);                   /* found file */
-	    res = 1; break;
-	  }
-	} else {
-	  while (isspace(ch) && ch != '\n') ch = getc(bpf);
-	                                             /* read to end of line */
-	  if ( ch == '\n' ) {                        /* didn't find it */
-	    res = -1; break;                         /* but host is there */
-	  }
-	  if ( ch == '\\' ) {                        /* more info */
-	    ch = getc(bpf);                          /* maybe on next line */
-	    if (ch == '\n') continue;                /* read it in next loop */
-	    ungetc(ch, bpf); ungetc('\\',bpf); /* push the character(s) back */
-	  } else ungetc(ch, bpf);              /* but who know what a `\` is */
-	}                                      /* needed for. */
-      } else break;                            /* a commented rest-of-line */
+  bpdb_release(db);
+  if (!nis)
+    return(0);
+#ifdef YP
+  if (nis_match(askname, result, sizeof(result)))
+    return (0);
+  if ((where = strstr(result, fileid)) != NULL &&
+      (where = strchr(where, '=')) != NULL) {
+    snprintf(buffer, sizeof(buffer), "%s", where + 1);
+    if ((where = strchr(buffer, ' ')) != NULL)
+      *where = '\0';
+    if ((where = strchr(buffer, ':')) != NULL) {
+      *where++ = '\0';
+      snprintf(server, slen, "%s", buffer);
+      snprintf(path, plen, "%s", where);
     }
   }
-  if (fclose(bpf)) { warnx("could not close %s", bootpfile); }
-  if ( res == -1) buffer[0] = '\0';            /* host found, file not */
-  return(match);
+  return(1);
+#else
+  return(0);	/* ENOTSUP */
+#endif
 }
 
 /* checkhost puts the hostname found in the database file in
@@ -291,68 +517,53 @@ char *askname;
 char *hostname;
 int len;
 {
-  int ch, pch;
-  FILE *bpf;
-  int res = 0;
+  struct bpdb *db;
+  u_int32_t i;
+  int nis;
 #ifdef YP
-  static char *result;
-  int resultlen;
-  static char *yp_domain;
+  char result[NIS_MAXVAL + 1];
+  char canon[MAX_MACHINE_NAME + 1];
 #endif
 
-/*  struct hostent *cmp_he;*/
-
-  bpf = fopen(bootpfile, "r");
-  if ( ! bpf )
-    errx(1, "no %s", bootpfile);
-
-  /* XXX there is no way in ISO C to specify the maximal length for a
-     conversion in a variable way */
-  while ( fscanf(bpf, "%254s", hostname) > 0 ) {
-    if ( *hostname != '#' ) { /* comment */
-      if ( ! strcmp(hostname, askname) ) {
-        /* return true for match of hostname */
-        res = 1;
-        break;
-      } else {
-        /* check the alias list */
-        he = NULL;
-        he = gethostbyname(hostname);
-        if (he && !strcmp(askname, he->h_name)) {
-  	  res = 1;
-	  break;
-        }
-      }
-    }
-    if (*hostname == '+' ) { /* NIS */
+  db = bpdb_acquire();
+  i = findhost(db, askname, &nis);
+  if (i != BPDB_NONE)
+    snprintf(hostname, len, "%s", bpdb_str(db, db->ent[i].name));
+  bpdb_release(db);
+  if (i != BPDB_NONE)
+    return(1);
+  if (!nis)
+    return(0);
 #ifdef YP
-      if (yp_get_default_domain(&yp_domain)) {
-	 if (debug) warn("NIS");
-	 return(0);
-      }
-      if (!yp_match(yp_domain, "bootparams", askname, strlen(askname),
-		&result, &resultlen)) {
-        /* return true for match of hostname */
-        he = NULL;
-        he = gethostbyname(askname);
-        if (he && !strcmp(askname, he->h_name)) {
-  	  res = 1;
-	  snprintf(hostname, len, "%s", he->h_name);
-	}
-      }
-      if (fclose(bpf))
-        warnx("could not close %s", bootpfile);
-      return(res);
-#else
-      return(0);	/* ENOTSUP */
-#endif
-    }
-    /* skip to next entry */
-    pch = ch = getc(bpf);
-    while ( ! ( ch == '\n' && pch != '\\') && ch != EOF) {
-      pch = ch; ch = getc(bpf);
+  if (!nis_match(askname, result, sizeof(result))) {
+    /* return true for match of hostname */
+    if (!rescache_byname(askname, canon, sizeof(canon), NULL, NULL) &&
+	!strcmp(askname, canon)) {
+      snprintf(hostname, len, "%s", canon);
+      return(1);
     }
   }
-  if (fclose(bpf)) { warnx("could not close %s", bootpfile); }
-  return(res);
+#endif
+  return(0);
+}
+
+/* checkaddr puts the name of the entry with the address addr (given
+   with ip= or resolved when the database was loaded) in the hostname-
+   variable and returns 1, if there is such an entry */
+
+int
+checkaddr(addr, hostname, len)
+in_addr_t addr;
+char *hostname;
+int len;
+{
+  struct bpdb *db;
+  u_int32_t i;
+
+  db = bpdb_acquire();
+  i = bpdb_lookup_addr(db, addr);
+  if (i != BPDB_NONE)
+    snprintf(hostname, len, "%s", bpdb_str(db, db->ent[i].name));
+  bpdb_release(db);
+  return(i != BPDB_NONE);
 }
@@ -0,0 +1,56 @@
+/*
+ * Declarations shared by the bootparamd modules.
+ */
+
+#ifndef BOOTPARAMD_H
+#define BOOTPARAMD_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <time.h>
+#include "bootparam_prot.h"
+#include "bpstats.h"
+
+extern int debug, dolog;
+extern in_addr_t route_addr;
+extern char *bootpfile;
+extern int nisrefresh;
+extern int timephases;
+
+/*
+ * Reply state of one request: the results point into the buffers here,
+ * so each thread serving requests has its own.  The handlers lower
+ * 'expires' to when the resolver answers they used expire, and with
+ * -p leave the microseconds each phase took in 'phase'.
+ */
+struct bp_state {
+	bp_whoami_res	whoami_res;
+	bp_getfile_res	getfile_res;
+	char		askname[MAX_MACHINE_NAME + 1];
+	char		hostname[MAX_MACHINE_NAME + 1];
+	char		domain_name[MAX_MACHINE_NAME + 1];
+	char		path[MAX_PATH_LEN + 1];
+	bp_getfiles_res	getfiles_res;
+	bp_getfiles_ent	files[MAX_FILEIDS];
+	char		fhost[MAX_FILEIDS][MAX_MACHINE_NAME + 1];
+	char		fpath[MAX_FILEIDS][MAX_PATH_LEN + 1];
+	time_t		expires;
+	u_long		phase[PH_NPHASES];
+};
+
+/* bootparamd.c */
+int loaddb(void);
+int compiledb(char *, char *);
+int getthefile(char *, char *, char *, int, char *, int);
+int checkhost(char *, char *, int);
+int checkaddr(in_addr_t, char *, int);
+bp_whoami_res *bp_whoami(bp_whoami_arg *, struct bp_state *);
+bp_getfile_res *bp_getfile(bp_getfile_arg *, struct bp_state *);
+bp_getfiles_res *bp_getfiles(bp_getfiles_arg *, struct bp_state *);
+void bp_phases(u_int32_t, void *, struct bp_state *);
+
+/* bpserver.c */
+int bpserver_socket(int);
+void bpserver_run(int, int, int);
+
+#endif /* BOOTPARAMD_H */
@@ -33,6 +33,14 @@ static const char rcsid[] =
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include "bootparam_prot.h"
+#include "bootparamd.h"
+#include "rescache.h"
+#include "replycache.h"
+#include "dupcache.h"
+#include "nis.h"
+#include "dbwatch.h"
+#include "bplog.h"
+#include "bpstats.h"
 
 int _rpcsvcdirty = 0;
 
@@ -41,9 +49,12 @@ int dolog = 0;
 in_addr_t route_addr = -1;
 struct sockaddr_in my_addr;
 char *bootpfile = "/etc/bootparams";
+int nisrefresh = NIS_DEFREFRESH;
+int timephases = 0;
 
 extern int get_myaddress(struct sockaddr_in *);
 extern  void bootparamprog_1();
+extern  void bootparamprog_2();
 static void usage(void);
 
 int
@@ -55,8 +66,13 @@ char **argv;
 	struct hostent *he;
 	struct stat buf;
 	int c;
+	int cachesize = RC_DEFSIZE, ttl = RC_DEFTTL, negttl = RC_DEFNEGTTL;
+	int nthreads = 0, shared = 0;
+	int dupsize = DC_DEFSIZE, dupttl = DC_DEFTTL;
+	int compile = 0;
+	char *statsock = NULL;
 
-	while ((c = getopt(argc, argv,"dsr:f:")) != -1)
+	while ((c = getopt(argc, argv,"dsr:f:c:t:n:j:PD:T:Cy:S:p")) != -1)
 	  switch (c) {
 	  case 'd':
 	    debug = 1;
@@ -77,6 +93,47 @@ char **argv;
 	  case 'f':
 	    bootpfile = optarg;
 	    break;
+	  case 'c':
+	    cachesize = atoi(optarg);
+	    if (cachesize < 0)
+	      usage();
+	    break;
+	  case 't':
+	    ttl = atoi(optarg);
+	    break;
+	  case 'n':
+	    negttl = atoi(optarg);
+	    break;
+	  case 'j':
+	    nthreads = atoi(optarg);
+	    if (nthreads < 1)
+	      usage();
+	    break;
+	  case 'P':
+	    shared = 1;
+	    break;
+	  case 'D':
+	    dupsize = atoi(optarg);
+	    if (dupsize < 0)
+	      usage();
+	    break;
+	  case 'T':
+	    dupttl = atoi(optarg);
+	    break;
+	  case 'C':
+	    compile = 1;
+	    break;
+	  case 'y':
+	    nisrefresh = atoi(optarg);
+	    if (nisrefresh < 0)
+	      usage();
+	    break;
+	  case 'S':
+	    statsock = optarg;
+	    break;
+	  case 'p':
+	    timephases = 1;
+	    break;
 	  case 's':
 	    dolog = 1;
 #ifndef LOG_DAEMON
@@ -90,8 +147,24 @@ char **argv;
 	    usage();
 	  }
 
+	if (compile) {
+	  if (argc - optind != 2)
+	    usage();
+	  exit(compiledb(argv[optind], argv[optind + 1]));
+	}
+
+	if (shared && !nthreads) {
+	  nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	  if (nthreads < 1)
+	    nthreads = 1;
+	}
+
 	if ( stat(bootpfile, &buf ) )
 	  err(1, "%s", bootpfile);
+	rescache_init(cachesize, ttl, negttl);
+	nis_init(cachesize, ttl, negttl);
+	if (loaddb())
+	  exit(1);
 
 	if (route_addr == -1) {
 	  get_myaddress(&my_addr);
@@ -122,13 +195,28 @@ char **argv;
 	}
 
 
+	if (debug || dolog)
+	  bplog_start();
+	bpstats_start(statsock);
+	dbwatch_start(bootpfile, loaddb);
+
+	if (nthreads) {
+	  replycache_init(cachesize);
+	  dupcache_init(dupsize, dupttl);
+	  bpserver_run(bpserver_socket(shared), nthreads, shared);
+	  errx(1, "bpserver_run returned");
+	}
+
 	(void)pmap_unset(BOOTPARAMPROG, BOOTPARAMVERS);
+	(void)pmap_unset(BOOTPARAMPROG, BOOTPARAMVERS2);
 
 	transp = svcudp_create(RPC_ANYSOCK);
 	if (transp == NULL)
 		errx(1, "cannot create udp service");
 	if (!svc_register(transp, BOOTPARAMPROG, BOOTPARAMVERS, bootparamprog_1, IPPROTO_UDP))
 		errx(1, "unable to register (BOOTPARAMPROG, BOOTPARAMVERS, udp)");
+	if (!svc_register(transp, BOOTPARAMPROG, BOOTPARAMVERS2, bootparamprog_2, IPPROTO_UDP))
+		errx(1, "unable to register (BOOTPARAMPROG, BOOTPARAMVERS2, udp)");
 
 	svc_run();
 	errx(1, "svc_run returned");
@@ -138,6 +226,10 @@ static void
 usage()
 {
 	fprintf(stderr,
-		"usage: bootparamd [-d] [-s] [-r router] [-f bootparmsfile]\n");
+		"usage: bootparamd [-d] [-s] [-r router] [-f bootparmsfile]\n"
+		"                  [-c cachesize] [-t ttl] [-n negttl] [-j threads] [-P]\n"
+		"                  [-D dupsize] [-T dupttl] [-y nisrefresh] [-S statsocket]\n"
+		"                  [-p]\n"
+		"       bootparamd [-d] -C bootparmsfile snapshot\n");
 	exit(1);
 }
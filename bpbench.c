@@ -0,0 +1,462 @@
+/*
+ * Microbenchmark of the bootparamd lookup paths (make bench).
+ *
+ * For each size given (by default 1000 to 1000000 hosts) a synthetic
+ * bootparams file is generated, with a varying number of file ids per
+ * host, some entries continued over several lines and some comments.
+ * Lookups by name (hits, misses and hits by the canonical name of an
+ * entry listed under another name) and by address are then timed with
+ * the scanning code bootparamd used to have, with the database parsed
+ * from the file and with the database mapped from a compiled snapshot.
+ *
+ * The resolver is replaced by a stub that knows every host of the file
+ * without asking anyone, so that only the lookup code itself is timed:
+ * host "hN" has the canonical name "hN.bench" and the address 10.N.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <ctype.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bootparam_prot.h"
+#include "bootparamd.h"
+#include "bpdb.h"
+#include "bptime.h"
+#include "rescache.h"
+
+#define NQUERY		1024		/* different questions asked */
+#define DEFBUDGET	200		/* milliseconds per measurement */
+#define MAXEXTRA	5		/* extra file ids per host */
+#define CANONSUF	".bench"
+
+enum { Q_HIT, Q_MISS, Q_ALIAS, Q_ADDR, NKIND };
+
+static const char *kindname[NKIND] = { "hit", "miss", "alias", "addr" };
+
+struct query {
+	char		name[MAX_MACHINE_NAME + 1];
+	char		fileid[MAX_FILEID + 1];
+	in_addr_t	addr;
+};
+
+/* The daemon's globals, which bootparamd.c refers to. */
+int debug = 0;
+int dolog = 0;
+in_addr_t route_addr = -1;
+char *bootpfile;
+int nisrefresh = 0;
+int timephases = 0;
+
+static u_long budget = DEFBUDGET * 1000UL;
+static struct query query[NKIND][NQUERY];
+static char legacyfile[64];		/* for the legacy scanner */
+
+/*
+ * The resolver stub, in place of rescache.c.
+ */
+
+struct rescache_stats rescache_stats;
+
+/* The number N of a name "hN" or "hN.bench", or -1 if it is not one. */
+static long
+hostnum(const char *name)
+{
+	char *end;
+	long n;
+
+	if (name[0] != 'h' || !isdigit((unsigned char)name[1]))
+		return (-1);
+	n = strtol(name + 1, &end, 10);
+	if (*end != '\0' && strcmp(end, CANONSUF) != 0)
+		return (-1);
+	return (n);
+}
+
+int
+resolve_name(const char *name, char *canon, size_t len, in_addr_t *addr)
+{
+	long n;
+
+	if ((n = hostnum(name)) < 0)
+		return (-1);
+	if (canon != NULL)
+		(void)snprintf(canon, len, "h%ld" CANONSUF, n);
+	if (addr != NULL)
+		*addr = htonl(0x0a000000 | (u_int32_t)n);
+	return (0);
+}
+
+int
+resolve_addr(in_addr_t addr, char *name, size_t len)
+{
+	u_int32_t a = ntohl(addr);
+
+	if ((a >> 24) != 10)
+		return (-1);
+	(void)snprintf(name, len, "h%u" CANONSUF, a & 0xffffff);
+	return (0);
+}
+
+void
+rescache_init(u_int size, int ttl, int negttl)
+{
+}
+
+int
+rescache_byname(const char *name, char *canon, size_t len, in_addr_t *addr,
+    time_t *expires)
+{
+	if (expires != NULL)
+		*expires = 0;
+	return (resolve_name(name, canon, len, addr));
+}
+
+int
+rescache_byaddr(in_addr_t addr, char *name, size_t len, time_t *expires)
+{
+	if (expires != NULL)
+		*expires = 0;
+	return (resolve_addr(addr, name, len));
+}
+
+/*
+ * The scanning lookups of the original bootparamd, which read the file
+ * for every request and resolved each name in it until one matched.
+ * Kept as they were apart from going to the stub and leaving out NIS.
+ */
+
+static char legacyhost[MAX_MACHINE_NAME];
+
+static int
+legacy_getthefile(const char *askname, const char *fileid, char *buffer,
+    int blen)
+{
+	FILE *bpf;
+	char *where, canon[MAX_MACHINE_NAME + 1];
+	int ch, pch, fid_len, res = 0;
+	int match = 0;
+	char info[MAX_FILEID + MAX_PATH_LEN + MAX_MACHINE_NAME + 3];
+
+	if ((bpf = fopen(legacyfile, "r")) == NULL)
+		err(1, "%s", legacyfile);
+	while (fscanf(bpf, "%255s", legacyhost) > 0 && !match) {
+		if (*legacyhost != '#') {
+			if (!strcmp(legacyhost, askname))
+				match = 1;
+			else if (!resolve_name(legacyhost, canon, sizeof(canon),
+			    NULL) && !strcmp(canon, askname))
+				match = 1;
+		}
+		if (match)
+			break;
+		pch = ch = getc(bpf);
+		while (!(ch == '\n' && pch != '\\') && ch != EOF) {
+			pch = ch;
+			ch = getc(bpf);
+		}
+	}
+	if (match) {
+		fid_len = strlen(fileid);
+		while (!res && fscanf(bpf, "%s", info) > 0) {
+			ch = getc(bpf);
+			if (*info == '#')
+				break;
+			if (!strncmp(info, fileid, fid_len) &&
+			    info[fid_len] == '=') {
+				where = info + fid_len + 1;
+				if (isprint((unsigned char)*where)) {
+					(void)snprintf(buffer, blen, "%s",
+					    where);
+					res = 1;
+					break;
+				}
+			} else {
+				while (isspace(ch) && ch != '\n')
+					ch = getc(bpf);
+				if (ch == '\n') {
+					res = -1;
+					break;
+				}
+				if (ch == '\\') {
+					ch = getc(bpf);
+					if (ch == '\n')
+						continue;
+					ungetc(ch, bpf);
+					ungetc('\\', bpf);
+				} else
+					ungetc(ch, bpf);
+			}
+		}
+	}
+	(void)fclose(bpf);
+	if (res == -1)
+		buffer[0] = '\0';
+	return (match);
+}
+
+static int
+legacy_checkhost(const char *askname, char *hostname, int len)
+{
+	FILE *bpf;
+	char canon[MAX_MACHINE_NAME + 1];
+	int ch, pch, res = 0;
+
+	if ((bpf = fopen(legacyfile, "r")) == NULL)
+		err(1, "%s", legacyfile);
+	while (fscanf(bpf, "%254s", hostname) > 0) {
+		if (*hostname != '#') {
+			if (!strcmp(hostname, askname)) {
+				res = 1;
+				break;
+			}
+			if (!resolve_name(hostname, canon, sizeof(canon),
+			    NULL) && !strcmp(askname, canon)) {
+				res = 1;
+				break;
+			}
+		}
+		pch = ch = getc(bpf);
+		while (!(ch == '\n' && pch != '\\') && ch != EOF) {
+			pch = ch;
+			ch = getc(bpf);
+		}
+	}
+	(void)fclose(bpf);
+	return (res);
+}
+
+/*
+ * The synthetic file and the questions asked about it.
+ */
+
+/* Write a bootparams file of 'nhost' hosts to 'path'. */
+static void
+generate(const char *path, u_long nhost)
+{
+	FILE *f;
+	u_long i;
+	int j, nextra;
+	const char *sep;
+
+	if ((f = fopen(path, "w")) == NULL)
+		err(1, "%s", path);
+	for (i = 0; i < nhost; i++) {
+		if (i % 100 == 0)
+			(void)fprintf(f, "# hosts %lu to %lu\n", i, i + 99);
+		/* every third entry has one file id per line */
+		sep = (i % 3 == 0) ? " \\\n\t" : " ";
+		(void)fprintf(f, "h%lu\troot=srv%lu:/export/h%lu/root%s"
+		    "swap=srv%lu:/export/h%lu/swap%sdump=srv%lu:/export/h%lu/dump",
+		    i, i % 16, i, sep, i % 16, i, sep, i % 16, i);
+		nextra = i % (MAXEXTRA + 1);
+		for (j = 0; j < nextra; j++)
+			(void)fprintf(f, "%sp%d=srv%lu:/export/h%lu/p%d", sep,
+			    j, i % 16, i, j);
+		(void)fputc('\n', f);
+	}
+	if (fclose(f) == EOF)
+		err(1, "%s", path);
+}
+
+/* The same random hosts for every implementation. */
+static void
+makequeries(u_long nhost)
+{
+	struct query *q;
+	u_long n;
+	int i, nextra;
+
+	srandom(1);
+	for (i = 0; i < NQUERY; i++) {
+		n = (u_long)random() % nhost;
+		nextra = n % (MAXEXTRA + 1);
+		/* ask for the last file id, the slowest one to scan to */
+		q = &query[Q_HIT][i];
+		(void)snprintf(q->name, sizeof(q->name), "h%lu", n);
+		if (nextra)
+			(void)snprintf(q->fileid, sizeof(q->fileid), "p%d",
+			    nextra - 1);
+		else
+			(void)snprintf(q->fileid, sizeof(q->fileid), "dump");
+		q = &query[Q_MISS][i];
+		(void)snprintf(q->name, sizeof(q->name), "m%lu", n);
+		(void)snprintf(q->fileid, sizeof(q->fileid), "root");
+		q = &query[Q_ALIAS][i];
+		(void)snprintf(q->name, sizeof(q->name), "h%lu" CANONSUF, n);
+		(void)snprintf(q->fileid, sizeof(q->fileid), "swap");
+		query[Q_ADDR][i].addr = htonl(0x0a000000 | (u_int32_t)n);
+	}
+}
+
+/*
+ * Timing.
+ */
+
+static int
+legacy_ask(int kind, struct query *q)
+{
+	char host[MAX_MACHINE_NAME + 1], buf[MAX_MACHINE_NAME + MAX_PATH_LEN + 2];
+
+	switch (kind) {
+	case Q_ADDR:
+		/* reverse lookup, then scan for the name */
+		if (resolve_addr(q->addr, host, sizeof(host)))
+			return (0);
+		return (legacy_checkhost(host, legacyhost, sizeof(legacyhost)));
+	default:
+		return (legacy_checkhost(q->name, host, sizeof(host)) &&
+		    legacy_getthefile(q->name, q->fileid, buf, sizeof(buf)));
+	}
+}
+
+static int
+index_ask(int kind, struct query *q)
+{
+	char host[MAX_MACHINE_NAME + 1], server[MAX_MACHINE_NAME + 1];
+	char path[MAX_PATH_LEN + 1];
+
+	switch (kind) {
+	case Q_ADDR:
+		return (checkaddr(q->addr, host, sizeof(host)));
+	default:
+		return (checkhost(q->name, host, sizeof(host)) &&
+		    getthefile(q->name, q->fileid, server, sizeof(server),
+		    path, sizeof(path)));
+	}
+}
+
+/*
+ * Ask questions of 'kind' until the time budget is used up and return
+ * the nanoseconds per question, after checking that each was answered
+ * (or not, for misses) as it should have been.
+ */
+static double
+measure(int (*ask)(int, struct query *), int kind)
+{
+	u_int64_t start, elapsed;
+	u_long n = 0;
+	int found;
+
+	start = bptime_usec();
+	do {
+		found = ask(kind, &query[kind][n % NQUERY]);
+		if (found != (kind != Q_MISS))
+			errx(1, "%s lookup of %s gave the wrong answer",
+			    kindname[kind], query[kind][n % NQUERY].name);
+		n++;
+	} while ((elapsed = bptime_usec() - start) < budget);
+	return (elapsed * 1000.0 / n);
+}
+
+static void
+report(u_long nhost, const char *impl, double loadms,
+    int (*ask)(int, struct query *))
+{
+	int kind;
+
+	(void)printf("%8lu  %-8s", nhost, impl);
+	if (loadms < 0)
+		(void)printf(" %10s", "-");
+	else
+		(void)printf(" %10.1f", loadms);
+	(void)fflush(stdout);
+	for (kind = 0; kind < NKIND; kind++) {
+		(void)printf(" %12.0f", measure(ask, kind));
+		(void)fflush(stdout);
+	}
+	(void)printf("\n");
+}
+
+/* Load 'path' as the database in use; returns the milliseconds taken. */
+static double
+load(const char *path)
+{
+	struct bpdb *db;
+	char errbuf[256];
+	u_int64_t start;
+
+	start = bptime_usec();
+	if ((db = bpdb_load(path, 0, errbuf, sizeof(errbuf))) == NULL)
+		errx(1, "%s", errbuf);
+	bpdb_publish(db);
+	return ((bptime_usec() - start) / 1000.0);
+}
+
+static void
+bench(u_long nhost, u_long legacymax)
+{
+	char snapfile[sizeof(legacyfile) + 3];
+	int fd;
+
+	(void)snprintf(legacyfile, sizeof(legacyfile), "/tmp/bpbench.XXXXXX");
+	if ((fd = mkstemp(legacyfile)) < 0)
+		err(1, "mkstemp");
+	(void)close(fd);
+	(void)snprintf(snapfile, sizeof(snapfile), "%s.db", legacyfile);
+	generate(legacyfile, nhost);
+	makequeries(nhost);
+
+	if (nhost <= legacymax)
+		report(nhost, "legacy", -1, legacy_ask);
+	bootpfile = legacyfile;
+	report(nhost, "index", load(legacyfile), index_ask);
+	if (compiledb(legacyfile, snapfile))
+		exit(1);
+	bootpfile = snapfile;
+	report(nhost, "snapshot", load(snapfile), index_ask);
+
+	(void)unlink(legacyfile);
+	(void)unlink(snapfile);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr,
+	    "usage: bpbench [-t ms] [-l maxlegacy] [hosts ...]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u_long defsizes[] = { 1000, 10000, 100000, 1000000 };
+	u_long nhost, legacymax = (u_long)-1;
+	size_t i;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:l:")) != -1)
+		switch (c) {
+		case 't':
+			if (atoi(optarg) < 1)
+				usage();
+			budget = atoi(optarg) * 1000UL;
+			break;
+		case 'l':
+			legacymax = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+
+	(void)printf("%8s  %-8s %10s %12s %12s %12s %12s\n", "hosts", "lookup",
+	    "load ms", "hit ns", "miss ns", "alias ns", "addr ns");
+	if (argc == 0)
+		for (i = 0; i < sizeof(defsizes) / sizeof(defsizes[0]); i++)
+			bench(defsizes[i], legacymax);
+	for (; argc > 0; argc--, argv++) {
+		if ((nhost = strtoul(*argv, NULL, 10)) < 1 ||
+		    nhost > 0xffffff)
+			usage();
+		bench(nhost, legacymax);
+	}
+	return (0);
+}
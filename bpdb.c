@@ -0,0 +1,612 @@
+/*
+ * In-memory bootparams database, see bpdb.h.
+ *
+ * The file format is that of bootparams(5), see bptok.c for how it is
+ * split into records.  A line starting with '+' means the NIS map is
+ * consulted at that point; entries after it are never reached and are
+ * not loaded, but the entries of the map itself may be.  The parameter
+ * "ip" gives an address of the host, which is then not taken from the
+ * resolver.
+ */
+
+#include "bootparam_prot.h"
+#include "bpdb.h"
+#include "bptok.h"
+#include "nis.h"
+#include "rescache.h"
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <arpa/inet.h>
+
+extern int dolog;
+
+struct parser {
+	struct bptok	tok;
+	struct bpdb	*db;
+	const char	*path;		/* of the file, NULL for the NIS map */
+	u_int32_t	entcap, filecap, strcap, addrcap;
+	in_addr_t	*resolved;	/* address of each entry, or 0 */
+};
+
+static pthread_mutex_t current_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct bpdb *current;
+static u_int generation;
+
+static u_int32_t
+hashname(const char *s)
+{
+	u_int32_t h = 2166136261U;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static u_int32_t
+hashaddr(in_addr_t addr)
+{
+	const unsigned char *s = (const unsigned char *)&addr;
+	u_int32_t h = 2166136261U;
+	int i;
+
+	for (i = 0; i < 4; i++) {
+		h ^= s[i];
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+static int
+grow(void **p, u_int32_t *cap, u_int32_t need, size_t size)
+{
+	u_int32_t n;
+	void *np;
+
+	if (need <= *cap)
+		return (0);
+	n = *cap ? *cap : 64;
+	while (n < need)
+		n *= 2;
+	if ((np = realloc(*p, (size_t)n * size)) == NULL)
+		return (-1);
+	*p = np;
+	*cap = n;
+	return (0);
+}
+
+static u_int32_t
+addstr(struct bpdb *db, struct parser *p, const char *s, size_t len)
+{
+	u_int32_t off = db->strsize;
+
+	if (grow((void **)&db->str, &p->strcap, off + len + 1, 1))
+		return (BPDB_NONE);
+	memcpy(db->str + off, s, len);
+	db->str[off + len] = '\0';
+	db->strsize += len + 1;
+	return (off);
+}
+
+/*
+ * Report the word 'r' of the entry being loaded as ignored 'why'.  The
+ * original scanners never matched such words, but still answered for
+ * the rest of the file, so neither does the loader fail on them.
+ */
+static void
+ignore(struct parser *p, const struct bprec *r, const char *why)
+{
+	const char *host;
+
+	host = bpdb_str(p->db, p->db->ent[p->db->nent - 1].name);
+	if (p->path == NULL) {
+		warnx("NIS bootparams: %s: %.64s: %s, ignored", host, r->name,
+		    why);
+		if (dolog) syslog(LOG_WARNING,
+		    "NIS bootparams: %s: %.64s: %s, ignored", host, r->name, why);
+	} else {
+		warnx("%s: line %d: %.64s: %s, ignored", p->path, r->line,
+		    r->name, why);
+		if (dolog) syslog(LOG_WARNING, "%s: line %d: %.64s: %s, ignored",
+		    p->path, r->line, r->name, why);
+	}
+}
+
+/*
+ * Add the parameter 'r' to the last entry.  A parameter that could never
+ * be looked up is skipped; only running out of memory fails.
+ */
+static int
+addfile(struct bpdb *db, struct parser *p, const struct bprec *r,
+    char *errbuf, size_t errlen)
+{
+	struct bpdb_file *f;
+	struct in_addr in;
+	const char *value = r->value, *colon;
+
+	if (strlen(r->name) > MAX_FILEID) {
+		ignore(p, r, "file id too long");
+		return (0);
+	}
+	if (!isprint((unsigned char)*value))
+		return (0);		/* empty value never matches */
+	if (!strcmp(r->name, "ip") && !inet_aton(value, &in)) {
+		ignore(p, r, "bad address");
+		return (0);
+	}
+	if (grow((void **)&db->file, &p->filecap, db->nfile + 1,
+	    sizeof(*db->file)))
+		goto nomem;
+	f = &db->file[db->nfile];
+	if ((colon = strchr(value, ':')) != NULL) {
+		if (colon == value) {
+			ignore(p, r, "no server");
+			return (0);
+		}
+		if (colon - value > MAX_MACHINE_NAME ||
+		    strlen(colon + 1) > MAX_PATH_LEN) {
+			ignore(p, r, "server or path too long");
+			return (0);
+		}
+		f->server = addstr(db, p, value, colon - value);
+		f->path = addstr(db, p, colon + 1, strlen(colon + 1));
+		if (f->server == BPDB_NONE)
+			goto nomem;
+	} else {
+		f->server = BPDB_NONE;
+		f->path = addstr(db, p, value, strlen(value));
+	}
+	f->fileid = addstr(db, p, r->name, strlen(r->name));
+	if (f->path == BPDB_NONE || f->fileid == BPDB_NONE)
+		goto nomem;
+	db->nfile++;
+	db->ent[db->nent - 1].nfile++;
+	return (0);
+nomem:
+	snprintf(errbuf, errlen, "%s", strerror(ENOMEM));
+	return (-1);
+}
+
+static int
+parse(struct bpdb *db, struct parser *p, char *errbuf, size_t errlen)
+{
+	struct bpdb_entry *e;
+	struct bprec r;
+	int skipping = 0;
+
+	for (;;) {
+		switch (bptok_next(&p->tok, &r)) {
+		case BR_EOF:
+			return (0);
+		case BR_ERROR:
+			snprintf(errbuf, errlen, "%s", p->tok.err);
+			return (-1);
+		case BR_NIS:
+			db->nis = db->nent;
+			return (0);
+		case BR_PARAM:
+			if (!skipping && addfile(db, p, &r, errbuf, errlen))
+				return (-1);
+			continue;
+		case BR_SKIP:
+			if (!skipping)
+				ignore(p, &r, "not a parameter");
+			continue;
+		case BR_HOST:
+			break;
+		}
+		/* no client can ask for a longer name */
+		if ((skipping = strlen(r.name) > MAX_MACHINE_NAME)) {
+			warnx("%s: line %d: name too long, entry ignored",
+			    p->path, r.line);
+			if (dolog) syslog(LOG_WARNING,
+			    "%s: line %d: name too long, entry ignored",
+			    p->path, r.line);
+			continue;
+		}
+		if (grow((void **)&db->ent, &p->entcap, db->nent + 1,
+		    sizeof(*db->ent)))
+			goto nomem;
+		e = &db->ent[db->nent++];
+		e->name = addstr(db, p, r.name, strlen(r.name));
+		if (e->name == BPDB_NONE)
+			goto nomem;
+		e->file = db->nfile;
+		e->nfile = 0;
+		e->next = BPDB_NONE;
+	}
+nomem:
+	snprintf(errbuf, errlen, "%s", strerror(ENOMEM));
+	return (-1);
+}
+
+/*
+ * Add the NIS map entry 'key' with the parameters 'val', as if it had
+ * been a line of the file.  A malformed entry is skipped rather than
+ * failing the whole load.
+ */
+static int
+addnis(void *arg, const char *key, size_t keylen, const char *val,
+    size_t vallen)
+{
+	struct parser *p = arg;
+	struct bpdb *db = p->db;
+	struct bptok t;
+	struct bprec r;
+	char line[MAX_MACHINE_NAME + 1 + NIS_MAXVAL + 1], msg[128];
+	u_int32_t nent = db->nent, nfile = db->nfile;
+	enum bprec_type type;
+	int len;
+
+	len = snprintf(line, sizeof(line), "%.*s %.*s", (int)keylen, key,
+	    (int)vallen, val);
+	if (len < 0 || (size_t)len >= sizeof(line))
+		return (0);
+	bptok_buf(&t, line, len);
+	if (bptok_next(&t, &r) != BR_HOST || strlen(r.name) > MAX_MACHINE_NAME)
+		return (0);
+	if (grow((void **)&db->ent, &p->entcap, db->nent + 1,
+	    sizeof(*db->ent)))
+		return (-1);
+	db->ent[db->nent].name = addstr(db, p, r.name, strlen(r.name));
+	if (db->ent[db->nent].name == BPDB_NONE)
+		return (-1);
+	db->ent[db->nent].file = db->nfile;
+	db->ent[db->nent].nfile = 0;
+	db->ent[db->nent].next = BPDB_NONE;
+	db->nent++;
+	while ((type = bptok_next(&t, &r)) == BR_PARAM || type == BR_SKIP)
+		if (type == BR_SKIP)
+			ignore(p, &r, "not a parameter");
+		else if (addfile(db, p, &r, msg, sizeof(msg)))
+			return (-1);
+	if (type != BR_EOF) {
+		/* drop the entry; its strings are only wasted space */
+		db->nent = nent;
+		db->nfile = nfile;
+	}
+	return (0);
+}
+
+static int
+buildhash(struct bpdb *db)
+{
+	u_int32_t i, j, *link;
+	const char *name;
+
+	db->nhash = 16;
+	while (db->nhash < db->nent * 2)
+		db->nhash *= 2;
+	if ((db->hash = malloc(db->nhash * sizeof(*db->hash))) == NULL)
+		return (-1);
+	for (i = 0; i < db->nhash; i++)
+		db->hash[i] = BPDB_NONE;
+
+	/* Append in file order; a duplicate host name keeps the first. */
+	for (i = 0; i < db->nent; i++) {
+		name = bpdb_str(db, db->ent[i].name);
+		link = &db->hash[hashname(name) & (db->nhash - 1)];
+		while ((j = *link) != BPDB_NONE) {
+			if (!strcmp(bpdb_str(db, db->ent[j].name), name))
+				break;
+			link = &db->ent[j].next;
+		}
+		if (j == BPDB_NONE)
+			*link = i;
+	}
+	return (0);
+}
+
+/*
+ * Resolve the canonical name of every entry and index the entries by
+ * it.  An entry whose name does not resolve is only found literally.
+ */
+static int
+buildalias(struct bpdb *db, struct parser *p)
+{
+	char canon[MAX_MACHINE_NAME + 1];
+	const char *name;
+	u_int32_t i, j, *link;
+
+	db->canon = malloc((db->nent + 1) * sizeof(*db->canon));
+	db->anext = malloc((db->nent + 1) * sizeof(*db->anext));
+	db->ahash = malloc(db->nhash * sizeof(*db->ahash));
+	p->resolved = calloc(db->nent + 1, sizeof(*p->resolved));
+	if (db->canon == NULL || db->anext == NULL || db->ahash == NULL ||
+	    p->resolved == NULL)
+		return (-1);
+	for (i = 0; i < db->nhash; i++)
+		db->ahash[i] = BPDB_NONE;
+
+	for (i = 0; i < db->nent; i++) {
+		db->anext[i] = BPDB_NONE;
+		name = bpdb_str(db, db->ent[i].name);
+		if (resolve_name(name, canon, sizeof(canon), &p->resolved[i])) {
+			db->canon[i] = BPDB_NONE;
+			continue;
+		}
+		if (!strcmp(canon, name))
+			db->canon[i] = db->ent[i].name;
+		else if ((db->canon[i] = addstr(db, p, canon,
+		    strlen(canon))) == BPDB_NONE)
+			return (-1);
+
+		name = bpdb_str(db, db->canon[i]);
+		link = &db->ahash[hashname(name) & (db->nhash - 1)];
+		while ((j = *link) != BPDB_NONE) {
+			if (!strcmp(bpdb_str(db, db->canon[j]), name))
+				break;
+			link = &db->anext[j];
+		}
+		if (j == BPDB_NONE)
+			*link = i;
+	}
+	return (0);
+}
+
+static int
+addaddr(struct bpdb *db, struct parser *p, in_addr_t addr, u_int32_t ent)
+{
+	struct bpdb_addr *a;
+	u_int32_t j, *link;
+
+	link = &db->iphash[hashaddr(addr) & (db->nhash - 1)];
+	while ((j = *link) != BPDB_NONE) {
+		if (db->addr[j].addr == addr)
+			return (0);	/* an earlier entry has it */
+		link = &db->addr[j].next;
+	}
+	if (grow((void **)&db->addr, &p->addrcap, db->naddr + 1,
+	    sizeof(*db->addr)))
+		return (-1);
+	a = &db->addr[db->naddr];
+	a->addr = addr;
+	a->ent = ent;
+	a->next = BPDB_NONE;
+	*link = db->naddr++;
+	return (0);
+}
+
+/*
+ * Index the entries by their "ip" parameters, or by the address their
+ * name resolved to in buildalias() if they have none.
+ */
+static int
+buildaddr(struct bpdb *db, struct parser *p)
+{
+	const struct bpdb_file *f, *end;
+	struct in_addr in;
+	u_int32_t i;
+	int explicit;
+
+	if ((db->iphash = malloc(db->nhash * sizeof(*db->iphash))) == NULL)
+		return (-1);
+	for (i = 0; i < db->nhash; i++)
+		db->iphash[i] = BPDB_NONE;
+
+	for (i = 0; i < db->nent; i++) {
+		explicit = 0;
+		f = &db->file[db->ent[i].file];
+		for (end = f + db->ent[i].nfile; f < end; f++) {
+			if (strcmp(bpdb_str(db, f->fileid), "ip") ||
+			    !inet_aton(bpdb_str(db, f->path), &in))
+				continue;
+			explicit = 1;
+			if (addaddr(db, p, in.s_addr, i))
+				return (-1);
+		}
+		if (!explicit && p->resolved[i] != 0 &&
+		    addaddr(db, p, p->resolved[i], i))
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * Parse the bootparams file 'path', or map it if it is a snapshot.  If
+ * 'flags' has BPDB_NIS, the NIS map is read in place of a '+' line, if
+ * possible.  On failure NULL is returned and the reason is left in
+ * 'errbuf'.
+ */
+struct bpdb *
+bpdb_load(const char *path, int flags, char *errbuf, size_t errlen)
+{
+	struct parser p;
+	struct bpdb *db;
+	u_int32_t nfile;
+	char msg[128];
+	int rv;
+
+	if (bpdb_issnapshot(path))
+		return (bpdb_map(path, errbuf, errlen));
+	memset(&p, 0, sizeof(p));
+	if (bptok_open(&p.tok, path)) {
+		snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+		return (NULL);
+	}
+	if ((db = calloc(1, sizeof(*db))) == NULL) {
+		snprintf(errbuf, errlen, "%s", strerror(errno));
+		bptok_close(&p.tok);
+		return (NULL);
+	}
+	db->nis = BPDB_NONE;
+	p.db = db;
+	p.path = path;
+
+	rv = parse(db, &p, msg, sizeof(msg));
+	if (rv == 0 && db->nis != BPDB_NONE && (flags & BPDB_NIS)) {
+		/* if the map cannot be read, it is looked up per request */
+		p.path = NULL;
+		nfile = db->nfile;
+		if (nis_all(addnis, &p) == 0)
+			db->nismap = 1;
+		else {
+			db->nent = db->nis;
+			db->nfile = nfile;
+		}
+	}
+	if (rv == 0 && (buildhash(db) || buildalias(db, &p) ||
+	    buildaddr(db, &p))) {
+		snprintf(msg, sizeof(msg), "%s", strerror(ENOMEM));
+		rv = -1;
+	}
+	bptok_close(&p.tok);
+	free(p.resolved);
+	if (rv) {
+		snprintf(errbuf, errlen, "%s: %s", path, msg);
+		bpdb_free(db);
+		return (NULL);
+	}
+	return (db);
+}
+
+void
+bpdb_free(struct bpdb *db)
+{
+	if (db == NULL)
+		return;
+	if (db->map != NULL) {
+		(void)munmap(db->map, db->maplen);
+		free(db);
+		return;
+	}
+	free(db->ent);
+	free(db->file);
+	free(db->hash);
+	free(db->canon);
+	free(db->ahash);
+	free(db->anext);
+	free(db->addr);
+	free(db->iphash);
+	free(db->str);
+	free(db);
+}
+
+/*
+ * Make 'db' the current database, dropping the reference to the
+ * previous one.
+ */
+void
+bpdb_publish(struct bpdb *db)
+{
+	struct bpdb *old;
+
+	db->refs = 1;
+	pthread_mutex_lock(&current_lock);
+	old = current;
+	current = db;
+	generation++;
+	pthread_mutex_unlock(&current_lock);
+	if (old != NULL)
+		bpdb_release(old);
+}
+
+/*
+ * Return a reference to the current database.
+ */
+struct bpdb *
+bpdb_acquire(void)
+{
+	struct bpdb *db;
+
+	pthread_mutex_lock(&current_lock);
+	db = current;
+	db->refs++;
+	pthread_mutex_unlock(&current_lock);
+	return (db);
+}
+
+/*
+ * Return a number that changes whenever a new database is published,
+ * for caches of answers derived from it.
+ */
+u_int
+bpdb_generation(void)
+{
+	u_int gen;
+
+	pthread_mutex_lock(&current_lock);
+	gen = generation;
+	pthread_mutex_unlock(&current_lock);
+	return (gen);
+}
+
+void
+bpdb_release(struct bpdb *db)
+{
+	u_int refs;
+
+	pthread_mutex_lock(&current_lock);
+	refs = --db->refs;
+	pthread_mutex_unlock(&current_lock);
+	if (refs == 0)
+		bpdb_free(db);
+}
+
+/*
+ * Return the index of the first entry named 'name', or BPDB_NONE.
+ */
+u_int32_t
+bpdb_lookup(const struct bpdb *db, const char *name)
+{
+	u_int32_t i;
+
+	i = db->hash[hashname(name) & (db->nhash - 1)];
+	while (i != BPDB_NONE && strcmp(bpdb_str(db, db->ent[i].name), name))
+		i = db->ent[i].next;
+	return (i);
+}
+
+/*
+ * Return the index of the first entry whose canonical name is 'name',
+ * or BPDB_NONE.
+ */
+u_int32_t
+bpdb_lookup_alias(const struct bpdb *db, const char *name)
+{
+	u_int32_t i;
+
+	i = db->ahash[hashname(name) & (db->nhash - 1)];
+	while (i != BPDB_NONE && strcmp(bpdb_str(db, db->canon[i]), name))
+		i = db->anext[i];
+	return (i);
+}
+
+/*
+ * Return the index of the first entry with the address 'addr', or
+ * BPDB_NONE.
+ */
+u_int32_t
+bpdb_lookup_addr(const struct bpdb *db, in_addr_t addr)
+{
+	u_int32_t i;
+
+	i = db->iphash[hashaddr(addr) & (db->nhash - 1)];
+	while (i != BPDB_NONE && db->addr[i].addr != addr)
+		i = db->addr[i].next;
+	return (i == BPDB_NONE ? BPDB_NONE : db->addr[i].ent);
+}
+
+/*
+ * Return the first file 'fileid' of entry 'ent', or NULL if the entry
+ * has no such file.
+ */
+const struct bpdb_file *
+bpdb_getfile(const struct bpdb *db, u_int32_t ent, const char *fileid)
+{
+	const struct bpdb_file *f, *end;
+
+	f = &db->file[db->ent[ent].file];
+	for (end = f + db->ent[ent].nfile; f < end; f++)
+		if (!strcmp(bpdb_str(db, f->fileid), fileid))
+			return (f);
+	return (NULL);
+}
@@ -0,0 +1,95 @@
+/*
+ * In-memory bootparams database.
+ *
+ * The bootparams file is parsed once into a table of entries (in file
+ * order) with each entry's fileid=server:path pairs already split, and
+ * a hash index on the host name.  The canonical name of each entry is
+ * resolved at load time into a second index, so that asking by an alias
+ * needs no resolver calls.  If the file has a '+' line, the entries of
+ * the NIS map can be loaded in its place.  The address of each entry,
+ * from an "ip=" parameter or else from resolving its name, goes into a
+ * third index so that WHOAMI needs no reverse lookup.  All strings live
+ * in a single string table and are referred to by offset, which also
+ * lets the tables be written to a file and mapped back in as they are
+ * (see bpdbsnap.c).
+ *
+ * A loaded database is never modified.  The one in use is published
+ * with bpdb_publish() and each request holds a reference to it from
+ * bpdb_acquire() to bpdb_release(), so a reload can replace it at any
+ * time without disturbing requests in progress.
+ */
+
+#ifndef BPDB_H
+#define BPDB_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <stddef.h>
+
+#define BPDB_NONE	((u_int32_t)-1)
+
+#define BPDB_NIS	0x01		/* bpdb_load(): read the NIS map */
+
+struct bpdb_entry {
+	u_int32_t	name;		/* host name as written in the file */
+	u_int32_t	file;		/* index of first file of this entry */
+	u_int32_t	nfile;		/* number of files */
+	u_int32_t	next;		/* next entry in hash chain */
+};
+
+struct bpdb_file {
+	u_int32_t	fileid;
+	u_int32_t	server;		/* BPDB_NONE if the value has no ':' */
+	u_int32_t	path;		/* after the ':', or the whole value */
+};
+
+struct bpdb_addr {
+	in_addr_t	addr;		/* network byte order */
+	u_int32_t	ent;		/* entry with this address */
+	u_int32_t	next;		/* next address in hash chain */
+};
+
+struct bpdb {
+	struct bpdb_entry *ent;		/* entries in file order */
+	u_int32_t	nent;
+	struct bpdb_file *file;
+	u_int32_t	nfile;
+	u_int32_t	*hash;		/* buckets, first entry or BPDB_NONE */
+	u_int32_t	nhash;		/* power of two */
+	u_int32_t	*canon;		/* canonical name of each entry */
+	u_int32_t	*ahash;		/* canonical name buckets */
+	u_int32_t	*anext;		/* canonical name hash chains */
+	struct bpdb_addr *addr;
+	u_int32_t	naddr;
+	u_int32_t	*iphash;	/* address buckets */
+	char		*str;		/* string table */
+	u_int32_t	strsize;
+	u_int32_t	nis;		/* entries before the '+' line, or
+					   BPDB_NONE if there is none */
+	int		nismap;		/* the entries after those are the
+					   whole NIS map */
+	u_int		refs;
+	void		*map;		/* mapped snapshot the tables are in */
+	size_t		maplen;
+};
+
+#define bpdb_str(db, off)	((const char *)(db)->str + (off))
+
+struct bpdb *bpdb_load(const char *, int, char *, size_t);
+void bpdb_free(struct bpdb *);
+void bpdb_publish(struct bpdb *);
+struct bpdb *bpdb_acquire(void);
+void bpdb_release(struct bpdb *);
+u_int bpdb_generation(void);
+u_int32_t bpdb_lookup(const struct bpdb *, const char *);
+u_int32_t bpdb_lookup_alias(const struct bpdb *, const char *);
+u_int32_t bpdb_lookup_addr(const struct bpdb *, in_addr_t);
+const struct bpdb_file *bpdb_getfile(const struct bpdb *, u_int32_t,
+    const char *);
+
+/* bpdbsnap.c */
+int bpdb_write(const struct bpdb *, const char *, char *, size_t);
+int bpdb_issnapshot(const char *);
+struct bpdb *bpdb_map(const char *, char *, size_t);
+
+#endif /* BPDB_H */
@@ -0,0 +1,406 @@
+/*
+ * Compiled bootparams database snapshots.
+ *
+ * "bootparamd -C" writes a loaded database to a file in the layout of
+ * struct bpdb: a header giving the size and offset of each table,
+ * followed by the tables themselves and a sorted string table with each
+ * string stored once.  Everything is referred to by offset, so a
+ * snapshot is used by mapping it read-only and pointing the struct bpdb
+ * at it, with no parsing or resolving at all.
+ *
+ * Snapshots are in the byte order of the machine that wrote them and
+ * are not accepted by one of the other order.  The canonical names and
+ * addresses are those resolved when the snapshot was written.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bpdb.h"
+
+#define SNAP_MAGIC	"BPDB"
+#define SNAP_VERSION	1
+
+struct snaphdr {
+	char		magic[4];
+	u_int32_t	version;	/* also tells the byte order */
+	u_int32_t	size;		/* of the whole file */
+	u_int32_t	nent, nfile, nhash, naddr, strsize, nis;
+	u_int32_t	ent, file, hash, canon, ahash, anext, addr, iphash,
+			str;		/* offsets of the tables */
+};
+
+/* for sorting string offsets by the strings (single-threaded use) */
+static const char *sortbase;
+
+struct remap {
+	u_int32_t	old, new;
+};
+
+static int
+cmpstr(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+	int c;
+
+	if ((c = strcmp(sortbase + x, sortbase + y)) != 0)
+		return (c);
+	return (x < y ? -1 : x > y);
+}
+
+static int
+cmpold(const void *a, const void *b)
+{
+	const struct remap *x = a, *y = b;
+
+	return (x->old < y->old ? -1 : x->old > y->old);
+}
+
+static u_int32_t
+newoff(const struct remap *map, size_t n, u_int32_t old)
+{
+	struct remap key, *r;
+
+	if (old == BPDB_NONE)
+		return (BPDB_NONE);
+	key.old = old;
+	r = bsearch(&key, map, n, sizeof(*map), cmpold);
+	return (r->new);
+}
+
+/*
+ * Build the sorted, deduplicated string table of 'db' into '*strp' and
+ * a table from the old offsets to the new into '*mapp'.
+ */
+static int
+sortstrings(const struct bpdb *db, char **strp, u_int32_t *sizep,
+    struct remap **mapp, size_t *nmapp)
+{
+	u_int32_t *offs, i, size;
+	struct remap *map;
+	size_t n = 0, len, j;
+	char *str;
+
+	offs = malloc((2 * (size_t)db->nent + 3 * (size_t)db->nfile + 1) *
+	    sizeof(*offs));
+	map = malloc((2 * (size_t)db->nent + 3 * (size_t)db->nfile + 1) *
+	    sizeof(*map));
+	str = malloc(db->strsize + 1);
+	if (offs == NULL || map == NULL || str == NULL)
+		goto fail;
+	for (i = 0; i < db->nent; i++) {
+		offs[n++] = db->ent[i].name;
+		if (db->canon[i] != BPDB_NONE)
+			offs[n++] = db->canon[i];
+	}
+	for (i = 0; i < db->nfile; i++) {
+		offs[n++] = db->file[i].fileid;
+		offs[n++] = db->file[i].path;
+		if (db->file[i].server != BPDB_NONE)
+			offs[n++] = db->file[i].server;
+	}
+	sortbase = db->str;
+	qsort(offs, n, sizeof(*offs), cmpstr);
+
+	size = 0;
+	for (j = 0; j < n; j++) {
+		if (j == 0 || strcmp(db->str + offs[j], db->str + offs[j - 1])) {
+			len = strlen(db->str + offs[j]) + 1;
+			memcpy(str + size, db->str + offs[j], len);
+			size += len;
+		}
+		map[j].old = offs[j];
+		map[j].new = size - (strlen(db->str + offs[j]) + 1);
+	}
+	qsort(map, n, sizeof(*map), cmpold);
+	free(offs);
+	*strp = str;
+	*sizep = size;
+	*mapp = map;
+	*nmapp = n;
+	return (0);
+fail:
+	free(offs);
+	free(map);
+	free(str);
+	return (-1);
+}
+
+static int
+writeall(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, p, len)) < 0) {
+			if (errno == EINTR)
+				continue;
+			return (-1);
+		}
+		p += n;
+		len -= n;
+	}
+	return (0);
+}
+
+/*
+ * Write 'db' as a snapshot to 'path', replacing it atomically so that
+ * a running bootparamd never sees a partial file.  On failure -1 is
+ * returned and the reason left in 'errbuf'.
+ */
+int
+bpdb_write(const struct bpdb *db, const char *path, char *errbuf,
+    size_t errlen)
+{
+	struct snaphdr h;
+	struct bpdb_entry *ent = NULL;
+	struct bpdb_file *file = NULL;
+	struct remap *map = NULL;
+	u_int32_t *canon = NULL, strsize, i, pad = 0;
+	char *str = NULL, *tmp = NULL;
+	size_t nmap, off;
+	int fd = -1, created = 0, rv = -1;
+
+	if (sortstrings(db, &str, &strsize, &map, &nmap) ||
+	    (ent = malloc((db->nent + 1) * sizeof(*ent))) == NULL ||
+	    (file = malloc((db->nfile + 1) * sizeof(*file))) == NULL ||
+	    (canon = malloc((db->nent + 1) * sizeof(*canon))) == NULL ||
+	    (tmp = malloc(strlen(path) + 8)) == NULL)
+		goto done;
+	for (i = 0; i < db->nent; i++) {
+		ent[i] = db->ent[i];
+		ent[i].name = newoff(map, nmap, ent[i].name);
+		canon[i] = newoff(map, nmap, db->canon[i]);
+	}
+	for (i = 0; i < db->nfile; i++) {
+		file[i].fileid = newoff(map, nmap, db->file[i].fileid);
+		file[i].server = newoff(map, nmap, db->file[i].server);
+		file[i].path = newoff(map, nmap, db->file[i].path);
+	}
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, SNAP_MAGIC, sizeof(h.magic));
+	h.version = SNAP_VERSION;
+	h.nent = db->nent;
+	h.nfile = db->nfile;
+	h.nhash = db->nhash;
+	h.naddr = db->naddr;
+	h.strsize = strsize;
+	h.nis = db->nis;
+	off = sizeof(h);
+	h.ent = off;
+	off += db->nent * sizeof(*ent);
+	h.file = off;
+	off += db->nfile * sizeof(*file);
+	h.hash = off;
+	off += db->nhash * sizeof(*db->hash);
+	h.canon = off;
+	off += db->nent * sizeof(*canon);
+	h.ahash = off;
+	off += db->nhash * sizeof(*db->ahash);
+	h.anext = off;
+	off += db->nent * sizeof(*db->anext);
+	h.addr = off;
+	off += db->naddr * sizeof(*db->addr);
+	h.iphash = off;
+	off += db->nhash * sizeof(*db->iphash);
+	h.str = off;
+	off += strsize;
+	if (off > (u_int32_t)-1 - 4) {
+		errno = EFBIG;
+		goto done;
+	}
+	h.size = (off + 3) & ~(size_t)3;
+
+	snprintf(tmp, strlen(path) + 8, "%s.XXXXXX", path);
+	if ((fd = mkstemp(tmp)) < 0)
+		goto done;
+	created = 1;
+	if (writeall(fd, &h, sizeof(h)) ||
+	    writeall(fd, ent, db->nent * sizeof(*ent)) ||
+	    writeall(fd, file, db->nfile * sizeof(*file)) ||
+	    writeall(fd, db->hash, db->nhash * sizeof(*db->hash)) ||
+	    writeall(fd, canon, db->nent * sizeof(*canon)) ||
+	    writeall(fd, db->ahash, db->nhash * sizeof(*db->ahash)) ||
+	    writeall(fd, db->anext, db->nent * sizeof(*db->anext)) ||
+	    writeall(fd, db->addr, db->naddr * sizeof(*db->addr)) ||
+	    writeall(fd, db->iphash, db->nhash * sizeof(*db->iphash)) ||
+	    writeall(fd, str, strsize) ||
+	    writeall(fd, &pad, h.size - off) ||
+	    fchmod(fd, 0644) || fsync(fd))
+		goto done;
+	if (close(fd) == 0 && rename(tmp, path) == 0)
+		rv = 0;
+	fd = -1;
+done:
+	if (rv) {
+		snprintf(errbuf, errlen, "%s: %s", path, strerror(errno));
+		if (fd >= 0)
+			(void)close(fd);
+		if (created)
+			(void)unlink(tmp);
+	}
+	free(ent);
+	free(file);
+	free(canon);
+	free(map);
+	free(str);
+	free(tmp);
+	return (rv);
+}
+
+/*
+ * Return true if 'path' starts like a snapshot (of any byte order or
+ * version, so that a mismatch is reported rather than parsed as text).
+ */
+int
+bpdb_issnapshot(const char *path)
+{
+	char magic[4];
+	int fd, rv;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (0);
+	rv = read(fd, magic, sizeof(magic)) == sizeof(magic) &&
+	    !memcmp(magic, SNAP_MAGIC, sizeof(magic));
+	(void)close(fd);
+	return (rv);
+}
+
+/* True if table 'off' of 'n' elements of 'size' bytes is in the file. */
+static int
+inside(const struct snaphdr *h, u_int32_t off, u_int32_t n, size_t size)
+{
+	return (off % 4 == 0 && off >= sizeof(*h) && off <= h->size &&
+	    n <= (h->size - off) / size);
+}
+
+static int
+validstr(const struct snaphdr *h, u_int32_t off, int none)
+{
+	return ((none && off == BPDB_NONE) || off < h->strsize);
+}
+
+/* Check that every index and offset in the snapshot is in range. */
+static int
+validate(const struct snaphdr *h, const struct bpdb *db)
+{
+	u_int32_t i;
+
+	if (h->nhash == 0 || (h->nhash & (h->nhash - 1)) ||
+	    h->strsize == 0 || db->str[h->strsize - 1] != '\0' ||
+	    (h->nis != BPDB_NONE && h->nis > h->nent))
+		return (0);
+	for (i = 0; i < h->nhash; i++)
+		if ((db->hash[i] != BPDB_NONE && db->hash[i] >= h->nent) ||
+		    (db->ahash[i] != BPDB_NONE && db->ahash[i] >= h->nent) ||
+		    (db->iphash[i] != BPDB_NONE && db->iphash[i] >= h->naddr))
+			return (0);
+	/* chains only lead forward, so they always end */
+	for (i = 0; i < h->nent; i++)
+		if (!validstr(h, db->ent[i].name, 0) ||
+		    !validstr(h, db->canon[i], 1) ||
+		    db->ent[i].file > h->nfile ||
+		    db->ent[i].nfile > h->nfile - db->ent[i].file ||
+		    (db->ent[i].next != BPDB_NONE &&
+		    (db->ent[i].next <= i || db->ent[i].next >= h->nent)) ||
+		    (db->anext[i] != BPDB_NONE &&
+		    (db->anext[i] <= i || db->anext[i] >= h->nent)))
+			return (0);
+	for (i = 0; i < h->nfile; i++)
+		if (!validstr(h, db->file[i].fileid, 0) ||
+		    !validstr(h, db->file[i].server, 1) ||
+		    !validstr(h, db->file[i].path, 0))
+			return (0);
+	for (i = 0; i < h->naddr; i++)
+		if (db->addr[i].ent >= h->nent ||
+		    (db->addr[i].next != BPDB_NONE &&
+		    (db->addr[i].next <= i || db->addr[i].next >= h->naddr)))
+			return (0);
+	return (1);
+}
+
+/*
+ * Map the snapshot 'path'.  On failure NULL is returned and the reason
+ * is left in 'errbuf'.
+ */
+struct bpdb *
+bpdb_map(const char *path, char *errbuf, size_t errlen)
+{
+	const struct snaphdr *h;
+	struct bpdb *db = NULL;
+	struct stat sb;
+	char *map = MAP_FAILED;
+	const char *msg = NULL;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &sb) < 0)
+		goto fail;
+	if (sb.st_size < (off_t)sizeof(*h) || sb.st_size > (u_int32_t)-1) {
+		msg = "bad snapshot size";
+		goto fail;
+	}
+	if ((map = mmap(NULL, sb.st_size, PROT_READ, MAP_SHARED, fd, 0)) ==
+	    MAP_FAILED)
+		goto fail;
+	(void)close(fd);
+	fd = -1;
+	h = (const struct snaphdr *)map;
+	if (memcmp(h->magic, SNAP_MAGIC, sizeof(h->magic)) ||
+	    h->version != SNAP_VERSION) {
+		msg = "unsupported snapshot version or byte order";
+		goto fail;
+	}
+	if (h->size != sb.st_size ||
+	    !inside(h, h->ent, h->nent, sizeof(*db->ent)) ||
+	    !inside(h, h->file, h->nfile, sizeof(*db->file)) ||
+	    !inside(h, h->hash, h->nhash, sizeof(*db->hash)) ||
+	    !inside(h, h->canon, h->nent, sizeof(*db->canon)) ||
+	    !inside(h, h->ahash, h->nhash, sizeof(*db->ahash)) ||
+	    !inside(h, h->anext, h->nent, sizeof(*db->anext)) ||
+	    !inside(h, h->addr, h->naddr, sizeof(*db->addr)) ||
+	    !inside(h, h->iphash, h->nhash, sizeof(*db->iphash)) ||
+	    !inside(h, h->str, h->strsize, 1)) {
+		msg = "corrupt snapshot";
+		goto fail;
+	}
+	if ((db = calloc(1, sizeof(*db))) == NULL)
+		goto fail;
+	db->ent = (struct bpdb_entry *)(map + h->ent);
+	db->nent = h->nent;
+	db->file = (struct bpdb_file *)(map + h->file);
+	db->nfile = h->nfile;
+	db->hash = (u_int32_t *)(map + h->hash);
+	db->nhash = h->nhash;
+	db->canon = (u_int32_t *)(map + h->canon);
+	db->ahash = (u_int32_t *)(map + h->ahash);
+	db->anext = (u_int32_t *)(map + h->anext);
+	db->addr = (struct bpdb_addr *)(map + h->addr);
+	db->naddr = h->naddr;
+	db->iphash = (u_int32_t *)(map + h->iphash);
+	db->str = map + h->str;
+	db->strsize = h->strsize;
+	db->nis = h->nis;
+	db->map = map;
+	db->maplen = sb.st_size;
+	if (!validate(h, db)) {
+		msg = "corrupt snapshot";
+		goto fail;
+	}
+	return (db);
+fail:
+	snprintf(errbuf, errlen, "%s: %s", path, msg ? msg : strerror(errno));
+	if (fd >= 0)
+		(void)close(fd);
+	if (map != MAP_FAILED)
+		(void)munmap(map, sb.st_size);
+	free(db);
+	return (NULL);
+}
@@ -0,0 +1,303 @@
+/*
+ * Asynchronous request log.
+ *
+ * Formatting a message and handing it to syslog() or stderr for every
+ * request costs more than answering it, and syslog() may block.  So the
+ * handlers only copy the fields of a request into a slot of a bounded
+ * ring, and a thread of its own formats and writes them out.
+ *
+ * The ring is a multi-producer, single-consumer queue without locks:
+ * a producer claims a position by advancing 'head' and then publishes
+ * the slot by setting its sequence number, which the drain thread waits
+ * for.  The drain thread sleeps on a condition variable only once it
+ * has found the ring empty, and only then does a producer take the lock
+ * to wake it.  When the ring is full the record is dropped and counted
+ * rather than holding up the request; the drain thread reports the
+ * drops.  The ring is allocated when the thread is started, so it costs
+ * nothing unless requests are logged.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bootparam_prot.h"
+#include "bplog.h"
+#include "bpstats.h"
+
+#define BL_SLOTS	4096		/* a power of two */
+
+extern int debug, dolog;
+
+struct blrec {
+	u_int32_t	proc;
+	int		result;
+	u_long		usec;
+	in_addr_t	addr;
+	char		client[MAX_MACHINE_NAME + 1];
+	char		fileid[MAX_FILEID + 1];
+	char		name[MAX_MACHINE_NAME + 1];
+	char		path[MAX_PATH_LEN + 1];
+	u_long		phase[PH_NPHASES];	/* for BL_PHASES */
+};
+
+struct slot {
+	u_long		seq;		/* position + 1 when full */
+	struct blrec	rec;
+};
+
+struct bplog_stats bplog_stats;
+
+static struct slot *ring;
+static u_long head;			/* next position to claim */
+static u_long tail;			/* next position to drain */
+static int running;
+static int waiting;			/* the drain thread is asleep */
+static pthread_mutex_t wait_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cond = PTHREAD_COND_INITIALIZER;
+
+static void
+copy(char *dst, const char *src, size_t size)
+{
+	if (src == NULL)
+		src = "";
+	(void)strncpy(dst, src, size - 1);
+	dst[size - 1] = '\0';
+}
+
+static void
+emit(const struct blrec *r)
+{
+	char buf[MAX_MACHINE_NAME + MAX_FILEID + 2 * MAX_MACHINE_NAME +
+	    MAX_PATH_LEN + 64];
+	char addr[INET_ADDRSTRLEN];
+	const char *proc;
+	int i;
+
+	proc = (r->proc == BOOTPARAMPROC_WHOAMI) ? "whoami" :
+	    (r->proc == BOOTPARAMPROC_GETFILE) ? "getfile" : "getfiles";
+	if (r->proc == BOOTPARAMPROC_WHOAMI)
+		(void)snprintf(buf, sizeof(buf), "%s %s", proc, r->client);
+	else
+		(void)snprintf(buf, sizeof(buf), "%s %s %s", proc, r->client,
+		    r->fileid);
+	switch (r->result) {
+	case BL_FAILED:
+		(void)snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+		    ": failed (%lu us)", r->usec);
+		break;
+	case BL_CACHED:
+		(void)snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+		    ": from reply cache");
+		break;
+	case BL_PHASES:
+		(void)snprintf(buf + strlen(buf), sizeof(buf) - strlen(buf),
+		    ":");
+		for (i = 0; i < PH_NPHASES; i++)
+			if (r->phase[i] != PH_NONE)
+				(void)snprintf(buf + strlen(buf),
+				    sizeof(buf) - strlen(buf), " %s %lu us",
+				    bpstats_phasename[i], r->phase[i]);
+		break;
+	default:
+		(void)inet_ntop(AF_INET, &r->addr, addr, sizeof(addr));
+		if (r->proc == BOOTPARAMPROC_WHOAMI)
+			(void)snprintf(buf + strlen(buf),
+			    sizeof(buf) - strlen(buf),
+			    ": %s domain %s router %s (%lu us)",
+			    r->name, r->path, addr, r->usec);
+		else
+			(void)snprintf(buf + strlen(buf),
+			    sizeof(buf) - strlen(buf),
+			    ": %s:%s address %s (%lu us)",
+			    r->name, r->path, addr, r->usec);
+		break;
+	}
+	if (debug) warnx("%s", buf);
+	if (dolog) syslog(LOG_NOTICE, "%s", buf);
+}
+
+/* True if the oldest record has been published. */
+static int
+ready(int order)
+{
+	return (__atomic_load_n(&ring[tail & (BL_SLOTS - 1)].seq, order) ==
+	    tail + 1);
+}
+
+/* Take the oldest record into 'r'; false if there is none. */
+static int
+take(struct blrec *r)
+{
+	struct slot *s = &ring[tail & (BL_SLOTS - 1)];
+
+	if (!ready(__ATOMIC_ACQUIRE))
+		return (0);
+	*r = s->rec;
+	__atomic_store_n(&s->seq, tail + BL_SLOTS, __ATOMIC_RELEASE);
+	tail++;
+	return (1);
+}
+
+static void *
+drain(void *arg)
+{
+	struct blrec r;
+	u_long dropped, reported = 0;
+
+	(void)arg;
+	for (;;) {
+		while (take(&r))
+			emit(&r);
+		dropped = __atomic_load_n(&bplog_stats.dropped,
+		    __ATOMIC_RELAXED);
+		if (dropped != reported) {
+			if (debug) warnx("log full, dropped %lu records",
+			    dropped - reported);
+			if (dolog) syslog(LOG_WARNING,
+			    "log full, dropped %lu records", dropped - reported);
+			reported = dropped;
+		}
+		/*
+		 * Say that we are going to sleep before looking at the ring
+		 * once more; a producer publishes before looking at 'waiting',
+		 * so one of the two sees the other.
+		 */
+		pthread_mutex_lock(&wait_lock);
+		__atomic_store_n(&waiting, 1, __ATOMIC_SEQ_CST);
+		if (!ready(__ATOMIC_SEQ_CST))
+			pthread_cond_wait(&wait_cond, &wait_lock);
+		__atomic_store_n(&waiting, 0, __ATOMIC_RELAXED);
+		pthread_mutex_unlock(&wait_lock);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/*
+ * Claim a record to fill in: a slot of the ring, or 'own' if the drain
+ * thread is not running.  Returns NULL if the ring is full.
+ */
+static struct blrec *
+claim(struct blrec *own, struct slot **sp, u_long *posp)
+{
+	struct slot *s;
+	u_long pos, seq;
+	long dif;
+
+	*sp = NULL;
+	if (!__atomic_load_n(&running, __ATOMIC_ACQUIRE))
+		return (own);
+	pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	for (;;) {
+		s = &ring[pos & (BL_SLOTS - 1)];
+		seq = __atomic_load_n(&s->seq, __ATOMIC_ACQUIRE);
+		dif = (long)(seq - pos);
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&head, &pos, pos + 1,
+			    1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			__atomic_fetch_add(&bplog_stats.dropped, 1,
+			    __ATOMIC_RELAXED);
+			return (NULL);
+		} else
+			pos = __atomic_load_n(&head, __ATOMIC_RELAXED);
+	}
+	*sp = s;
+	*posp = pos;
+	return (&s->rec);
+}
+
+/* Hand a filled-in record over to the drain thread, waking it if asleep. */
+static void
+publish(struct blrec *r, struct slot *s, u_long pos)
+{
+	__atomic_fetch_add(&bplog_stats.logged, 1, __ATOMIC_RELAXED);
+	if (s == NULL) {
+		emit(r);
+		return;
+	}
+	__atomic_store_n(&s->seq, pos + 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&waiting, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&wait_lock);
+		pthread_cond_signal(&wait_cond);
+		pthread_mutex_unlock(&wait_lock);
+	}
+}
+
+/*
+ * Log a request for 'proc' from 'client' (the address for WHOAMI, the
+ * name for GETFILE) with its 'result'.  A successful reply is 'name',
+ * 'path' (the domain for WHOAMI) and 'addr' (router or server address),
+ * answered in 'usec' microseconds.  Never blocks; until bplog_start()
+ * has been called, the record is written out directly.
+ */
+void
+bplog_request(u_int32_t proc, int result, const char *client,
+    const char *fileid, const char *name, const char *path, in_addr_t addr,
+    u_long usec)
+{
+	struct blrec *r, rec;
+	struct slot *s;
+	u_long pos;
+
+	if ((r = claim(&rec, &s, &pos)) == NULL)
+		return;
+	r->proc = proc;
+	r->result = result;
+	r->usec = usec;
+	r->addr = addr;
+	copy(r->client, client, sizeof(r->client));
+	copy(r->fileid, fileid, sizeof(r->fileid));
+	copy(r->name, name, sizeof(r->name));
+	copy(r->path, path, sizeof(r->path));
+	publish(r, s, pos);
+}
+
+/*
+ * Log how long each phase of a request took, PH_NONE for the phases
+ * it did not reach.
+ */
+void
+bplog_phases(u_int32_t proc, const char *client, const char *fileid,
+    const u_long *phase)
+{
+	struct blrec *r, rec;
+	struct slot *s;
+	u_long pos;
+
+	if ((r = claim(&rec, &s, &pos)) == NULL)
+		return;
+	r->proc = proc;
+	r->result = BL_PHASES;
+	copy(r->client, client, sizeof(r->client));
+	copy(r->fileid, fileid, sizeof(r->fileid));
+	memcpy(r->phase, phase, sizeof(r->phase));
+	publish(r, s, pos);
+}
+
+/*
+ * Start the drain thread.  Must be called after the daemon has forked,
+ * and only if requests are logged at all.
+ */
+void
+bplog_start(void)
+{
+	pthread_t tid;
+	u_long i;
+
+	if ((ring = malloc(BL_SLOTS * sizeof(*ring))) == NULL)
+		errx(1, "cannot allocate the log ring");
+	for (i = 0; i < BL_SLOTS; i++)
+		ring[i].seq = i;
+	if (pthread_create(&tid, NULL, drain, NULL) != 0)
+		errx(1, "cannot start the log thread");
+	(void)pthread_detach(tid);
+	__atomic_store_n(&running, 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,29 @@
+/*
+ * Asynchronous request log, see bplog.c.
+ */
+
+#ifndef BPLOG_H
+#define BPLOG_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+/* results */
+#define BL_FAILED	0
+#define BL_OK		1
+#define BL_CACHED	2		/* answered from the reply cache */
+#define BL_PHASES	3		/* phase times, see bplog_phases() */
+
+struct bplog_stats {
+	u_long	logged;
+	u_long	dropped;		/* because the ring was full */
+};
+
+extern struct bplog_stats bplog_stats;
+
+void bplog_start(void);
+void bplog_request(u_int32_t, int, const char *, const char *,
+    const char *, const char *, in_addr_t, u_long);
+void bplog_phases(u_int32_t, const char *, const char *, const u_long *);
+
+#endif /* BPLOG_H */
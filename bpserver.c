@@ -0,0 +1,488 @@
+/*
+ * Multi-threaded UDP server for BOOTPARAMPROG.
+ *
+ * Used instead of svc_run() when bootparamd is given -j: each of the
+ * worker threads receives calls from the same socket and decodes,
+ * answers and replies to them with its own buffers and reply state,
+ * so that a slow lookup only holds up the thread doing it.
+ *
+ * Where recvmmsg() and sendmmsg() exist, each thread takes up to BATCH
+ * waiting calls from the socket at once and sends all their replies
+ * with one call, saving a pair of system calls per datagram when many
+ * clients boot at the same time.
+ *
+ * With -P each thread instead has a socket of its own, all bound to the
+ * same port with SO_REUSEPORT, and the kernel spreads the clients over
+ * them.  Only the first socket is registered with the portmapper.
+ *
+ * The arguments and results of WHOAMI and GETFILE are decoded and
+ * encoded by bpxdr.c rather than the rpcgen routines, so that serving
+ * a request allocates nothing.
+ *
+ * Successful replies are kept encoded in the reply cache, so a repeated
+ * question is answered without running the handler or XDR at all.
+ * Before that, retransmissions of a call are caught by the duplicate
+ * request cache, which also stops them from being answered twice.
+ */
+
+#ifdef __linux__
+#define _GNU_SOURCE		/* recvmmsg(), sendmmsg() */
+#endif
+
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "bootparamd.h"
+#include "bpdb.h"
+#include "bplog.h"
+#include "bpstats.h"
+#include "bptime.h"
+#include "bpxdr.h"
+#include "dupcache.h"
+#include "replycache.h"
+
+#ifndef UDPMSGSIZE
+#define UDPMSGSIZE	8800
+#endif
+
+#ifdef MSG_WAITFORONE
+#define HAVE_RECVMMSG
+#define BATCH		16
+#else
+#define BATCH		1
+#endif
+
+struct dgram {
+	struct sockaddr_in from;
+	socklen_t	fromlen;
+	size_t		len;		/* of the call */
+	size_t		rlen;		/* of the reply, 0 for none */
+	char		in[UDPMSGSIZE];
+	char		out[UDPMSGSIZE];
+};
+
+#ifdef SO_REUSEPORT_LB
+#define REUSEPORT	SO_REUSEPORT_LB	/* FreeBSD: SO_REUSEPORT does not balance */
+#elif defined(SO_REUSEPORT)
+#define REUSEPORT	SO_REUSEPORT
+#endif
+
+struct worker {
+	int		sock;
+	struct bp_state	st;
+	struct dgram	d[BATCH];
+#ifdef HAVE_RECVMMSG
+	struct mmsghdr	hdr[BATCH];
+	struct iovec	iov[BATCH];
+#endif
+};
+
+static int
+udp_socket(int shared)
+{
+	int sock, on = 1;
+
+	if ((sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+		err(1, "socket");
+	if (shared) {
+#ifdef REUSEPORT
+		if (setsockopt(sock, SOL_SOCKET, REUSEPORT, &on,
+		    sizeof(on)) < 0)
+			err(1, "setsockopt SO_REUSEPORT");
+#else
+		errx(1, "SO_REUSEPORT is not supported");
+#endif
+	}
+	return (sock);
+}
+
+/*
+ * Create the UDP socket on a reserved port if possible, like
+ * svcudp_create(RPC_ANYSOCK), and register it with the portmapper.
+ * If 'shared' is set, more sockets may later be bound to the same port.
+ */
+int
+bpserver_socket(int shared)
+{
+	struct sockaddr_in sin;
+	socklen_t len;
+	int sock;
+
+	sock = udp_socket(shared);
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if (bindresvport(sock, &sin)) {
+		sin.sin_port = 0;
+		if (bind(sock, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+			err(1, "bind");
+	}
+	len = sizeof(sin);
+	if (getsockname(sock, (struct sockaddr *)&sin, &len) < 0)
+		err(1, "getsockname");
+
+	(void)pmap_unset(BOOTPARAMPROG, BOOTPARAMVERS);
+	(void)pmap_unset(BOOTPARAMPROG, BOOTPARAMVERS2);
+	if (!pmap_set(BOOTPARAMPROG, BOOTPARAMVERS, IPPROTO_UDP,
+	    ntohs(sin.sin_port)))
+		errx(1, "unable to register (BOOTPARAMPROG, BOOTPARAMVERS, udp)");
+	if (!pmap_set(BOOTPARAMPROG, BOOTPARAMVERS2, IPPROTO_UDP,
+	    ntohs(sin.sin_port)))
+		errx(1, "unable to register (BOOTPARAMPROG, BOOTPARAMVERS2, udp)");
+	return (sock);
+}
+
+/* Another socket bound to the same address as 'sock'. */
+static int
+shard_socket(int sock)
+{
+	struct sockaddr_in sin;
+	socklen_t len;
+	int s;
+
+	len = sizeof(sin);
+	if (getsockname(sock, (struct sockaddr *)&sin, &len) < 0)
+		err(1, "getsockname");
+	s = udp_socket(1);
+	if (bind(s, (struct sockaddr *)&sin, len) < 0)
+		err(1, "bind port %d", ntohs(sin.sin_port));
+	return (s);
+}
+
+/*
+ * Build the reply cache key for the argument of 'proc' into 'key', of
+ * at least MAX_MACHINE_NAME + 1 + MAX_FILEID bytes.  Returns its length.
+ */
+static size_t
+replykey(u_int32_t proc, void *arg, char *key)
+{
+	bp_whoami_arg *whoami = arg;
+	bp_getfile_arg *getfile = arg;
+	size_t n, m;
+
+	if (proc == BOOTPARAMPROC_WHOAMI) {
+		memcpy(key, &whoami->client_address.bp_address_u.ip_addr, 4);
+		return (4);
+	}
+	n = strlen(getfile->client_name);
+	m = strlen(getfile->file_id);
+	memcpy(key, getfile->client_name, n + 1);
+	memcpy(key + n + 1, getfile->file_id, m);
+	return (n + 1 + m);
+}
+
+/* Log a call for 'proc' with argument 'arg' answered from the reply cache. */
+static void
+logcached(u_int32_t proc, void *arg)
+{
+	bp_whoami_arg *whoami = arg;
+	bp_getfile_arg *getfile = arg;
+	char client[INET_ADDRSTRLEN];
+
+	if (proc == BOOTPARAMPROC_WHOAMI) {
+		(void)inet_ntop(AF_INET,
+		    &whoami->client_address.bp_address_u.ip_addr,
+		    client, sizeof(client));
+		bplog_request(proc, BL_CACHED, client, NULL, NULL, NULL, 0, 0);
+	} else
+		bplog_request(proc, BL_CACHED, getfile->client_name,
+		    getfile->file_id, NULL, NULL, 0, 0);
+}
+
+/*
+ * Answer the call in d->in, leaving the reply in d->out.  Returns the
+ * length of the reply, or 0 if nothing is to be sent: as with the
+ * rpcgen dispatcher, a failed lookup gets no reply at all.
+ */
+static size_t
+answer(struct worker *w, struct dgram *d)
+{
+	struct rpc_msg call, reply;
+	char cred[2 * MAX_AUTH_BYTES];
+	struct bpxdr_args args;
+	void *arg = &args.u, *res = NULL;
+	char key[MAX_MACHINE_NAME + 1 + MAX_FILEID];
+	size_t klen = 0, rlen, n;
+	u_int32_t xid, proc;
+	u_int gen = 0;
+	u_int64_t t = 0;
+	int hasarg = 0, timed = timephases;
+	XDR xdrs;
+
+	memset(&call, 0, sizeof(call));
+	call.rm_call.cb_cred.oa_base = cred;
+	call.rm_call.cb_verf.oa_base = cred + MAX_AUTH_BYTES;
+	xdrmem_create(&xdrs, d->in, d->len, XDR_DECODE);
+	if (!xdr_callmsg(&xdrs, &call) || call.rm_direction != CALL)
+		return (0);
+	proc = call.rm_call.cb_proc;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.rm_xid = call.rm_xid;
+	reply.rm_direction = REPLY;
+	reply.rm_reply.rp_stat = MSG_ACCEPTED;
+	reply.acpted_rply.ar_verf = _null_auth;
+	reply.acpted_rply.ar_stat = SUCCESS;
+	reply.acpted_rply.ar_results.where = NULL;
+	reply.acpted_rply.ar_results.proc = (xdrproc_t)xdr_void;
+
+	if (call.rm_call.cb_rpcvers != RPC_MSG_VERSION) {
+		reply.rm_reply.rp_stat = MSG_DENIED;
+		reply.rjcted_rply.rj_stat = RPC_MISMATCH;
+		reply.rjcted_rply.rj_vers.low = RPC_MSG_VERSION;
+		reply.rjcted_rply.rj_vers.high = RPC_MSG_VERSION;
+	} else if (call.rm_call.cb_prog != BOOTPARAMPROG) {
+		reply.acpted_rply.ar_stat = PROG_UNAVAIL;
+	} else if (call.rm_call.cb_vers != BOOTPARAMVERS &&
+	    call.rm_call.cb_vers != BOOTPARAMVERS2) {
+		reply.acpted_rply.ar_stat = PROG_MISMATCH;
+		reply.acpted_rply.ar_vers.low = BOOTPARAMVERS;
+		reply.acpted_rply.ar_vers.high = BOOTPARAMVERS2;
+	} else switch (proc) {
+	case NULLPROC:
+		break;
+	case BOOTPARAMPROC_GETFILES:
+		if (call.rm_call.cb_vers != BOOTPARAMVERS2) {
+			reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+			break;
+		}
+		/* FALLTHROUGH */
+	case BOOTPARAMPROC_WHOAMI:
+	case BOOTPARAMPROC_GETFILE:
+		hasarg = 1;
+		break;
+	default:
+		reply.acpted_rply.ar_stat = PROC_UNAVAIL;
+		break;
+	}
+
+	if (hasarg) {
+		n = xdr_getpos(&xdrs);
+		if (bpxdr_decode_arg(proc, d->in + n, d->len - n, &args) == 0)
+			reply.acpted_rply.ar_stat = GARBAGE_ARGS;
+		else if (proc == BOOTPARAMPROC_GETFILES) {
+			/* always answered, and not worth caching */
+			w->st.expires = LONG_MAX;
+			res = bp_getfiles(&args.u.getfiles, &w->st);
+			timed = 0;
+		} else {
+			klen = replykey(proc, arg, key);
+			gen = bpdb_generation();
+			if ((rlen = replycache_lookup(proc, key, klen, gen,
+			    d->out + 4)) > 0) {
+				bpstats_count(proc == BOOTPARAMPROC_WHOAMI ?
+				    BS_WHOAMI_CACHED : BS_GETFILE_CACHED);
+				if (debug || dolog)
+					logcached(proc, arg);
+				xid = htonl(call.rm_xid);
+				memcpy(d->out, &xid, 4);
+				return (rlen + 4);
+			}
+			w->st.expires = LONG_MAX;
+			if (proc == BOOTPARAMPROC_WHOAMI)
+				res = bp_whoami(&args.u.whoami, &w->st);
+			else
+				res = bp_getfile(&args.u.getfile, &w->st);
+			if (res == NULL) {
+				if (timed)
+					bp_phases(proc, arg, &w->st);
+				return (0);
+			}
+		}
+	}
+
+	if (timed && res != NULL)
+		t = bptime_usec();
+	/* the header by XDR, then the results (if any) directly after it */
+	xdrmem_create(&xdrs, d->out, sizeof(d->out), XDR_ENCODE);
+	rlen = xdr_replymsg(&xdrs, &reply) ? xdr_getpos(&xdrs) : 0;
+	if (res != NULL && rlen > 0 && (n = bpxdr_encode_res(proc,
+	    d->out + rlen, sizeof(d->out) - rlen, res)) > 0)
+		rlen += n;
+	else if (res != NULL && rlen > 0) {
+		/* too large for a datagram (only GETFILES can be) */
+		res = NULL;
+		reply.acpted_rply.ar_stat = SYSTEM_ERR;
+		xdrmem_create(&xdrs, d->out, sizeof(d->out), XDR_ENCODE);
+		rlen = xdr_replymsg(&xdrs, &reply) ? xdr_getpos(&xdrs) : 0;
+	}
+	if (timed && res != NULL) {
+		w->st.phase[PH_ENCODE] = (u_long)(bptime_usec() - t);
+		bp_phases(proc, arg, &w->st);
+	}
+	if (res != NULL && klen > 0 && rlen > 4)
+		replycache_store(proc, key, klen, gen, w->st.expires,
+		    d->out + 4, rlen - 4);
+	return (rlen);
+}
+
+#ifdef HAVE_RECVMMSG
+/*
+ * Wait for at least one call and take as many more as are waiting, up
+ * to BATCH.  Returns the number received.
+ */
+static int
+recv_batch(struct worker *w)
+{
+	int i, n;
+
+	for (i = 0; i < BATCH; i++) {
+		w->iov[i].iov_base = w->d[i].in;
+		w->iov[i].iov_len = sizeof(w->d[i].in);
+		memset(&w->hdr[i], 0, sizeof(w->hdr[i]));
+		w->hdr[i].msg_hdr.msg_name = &w->d[i].from;
+		w->hdr[i].msg_hdr.msg_namelen = sizeof(w->d[i].from);
+		w->hdr[i].msg_hdr.msg_iov = &w->iov[i];
+		w->hdr[i].msg_hdr.msg_iovlen = 1;
+	}
+	if ((n = recvmmsg(w->sock, w->hdr, BATCH, MSG_WAITFORONE, NULL)) < 0)
+		return (-1);
+	for (i = 0; i < n; i++) {
+		w->d[i].len = w->hdr[i].msg_len;
+		w->d[i].fromlen = w->hdr[i].msg_hdr.msg_namelen;
+	}
+	return (n);
+}
+
+/* Send the replies to the first 'n' calls, skipping those without one. */
+static void
+send_batch(struct worker *w, int n)
+{
+	int i, m, sent;
+
+	for (i = m = 0; i < n; i++) {
+		if (w->d[i].rlen == 0)
+			continue;
+		w->iov[m].iov_base = w->d[i].out;
+		w->iov[m].iov_len = w->d[i].rlen;
+		memset(&w->hdr[m], 0, sizeof(w->hdr[m]));
+		w->hdr[m].msg_hdr.msg_name = &w->d[i].from;
+		w->hdr[m].msg_hdr.msg_namelen = w->d[i].fromlen;
+		w->hdr[m].msg_hdr.msg_iov = &w->iov[m];
+		w->hdr[m].msg_hdr.msg_iovlen = 1;
+		m++;
+	}
+	for (i = 0; i < m; i += sent) {
+		if ((sent = sendmmsg(w->sock, w->hdr + i, m - i, 0)) < 0) {
+			if (errno == EINTR) {
+				sent = 0;
+				continue;
+			}
+			if (dolog)
+				syslog(LOG_ERR, "sendmmsg: %m");
+			sent = 1;	/* drop the one that failed */
+		}
+	}
+}
+
+#else
+static int
+recv_batch(struct worker *w)
+{
+	ssize_t n;
+
+	w->d[0].fromlen = sizeof(w->d[0].from);
+	if ((n = recvfrom(w->sock, w->d[0].in, sizeof(w->d[0].in), 0,
+	    (struct sockaddr *)&w->d[0].from, &w->d[0].fromlen)) < 0)
+		return (-1);
+	w->d[0].len = n;
+	return (1);
+}
+
+static void
+send_batch(struct worker *w, int n)
+{
+	if (n > 0 && w->d[0].rlen > 0 &&
+	    sendto(w->sock, w->d[0].out, w->d[0].rlen, 0,
+	    (struct sockaddr *)&w->d[0].from, w->d[0].fromlen) < 0 && dolog)
+		syslog(LOG_ERR, "sendto: %m");
+}
+#endif
+
+/*
+ * Answer the call in d->in unless it is a duplicate, see answer().
+ */
+static size_t
+dispatch(struct worker *w, struct dgram *d)
+{
+	u_int32_t xid, proc;
+	size_t rlen;
+
+	/* the XID and procedure are the first and sixth words of a call */
+	if (d->len < 6 * 4)
+		return (0);
+	memcpy(&xid, d->in, 4);
+	memcpy(&proc, d->in + 5 * 4, 4);
+	switch (dupcache_check(&d->from, xid, proc, d->out, &rlen)) {
+	case DC_BUSY:
+		if (debug)
+			warnx("dropped duplicate (%lu dropped, %lu replayed)",
+			    dupcache_stats.dropped, dupcache_stats.replayed);
+		return (0);
+	case DC_REPLAY:
+		if (debug)
+			warnx("replayed duplicate (%lu dropped, %lu replayed)",
+			    dupcache_stats.dropped, dupcache_stats.replayed);
+		return (rlen);
+	}
+	rlen = answer(w, d);
+	dupcache_done(&d->from, xid, proc, d->out, rlen);
+	return (rlen);
+}
+
+static void *
+worker(void *arg)
+{
+	struct worker *w = arg;
+	int i, n;
+
+	for (;;) {
+		if ((n = recv_batch(w)) < 0) {
+			if (errno != EINTR && dolog)
+				syslog(LOG_ERR, "recv: %m");
+			continue;
+		}
+		for (i = 0; i < n; i++)
+			w->d[i].rlen = dispatch(w, &w->d[i]);
+		send_batch(w, n);
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/*
+ * Serve 'sock' with 'nthreads' threads, including the calling one,
+ * giving each thread a socket of its own if 'shared' is set (in which
+ * case 'sock' must have been created with it).  Does not return.
+ */
+void
+bpserver_run(int sock, int nthreads, int shared)
+{
+	struct worker *w;
+	pthread_t tid;
+	int i;
+
+	if ((w = calloc(nthreads, sizeof(*w))) == NULL)
+		err(1, "calloc");
+	for (i = 0; i < nthreads; i++) {
+		w[i].sock = (shared && i > 0) ? shard_socket(sock) : sock;
+		if (i > 0 &&
+		    (errno = pthread_create(&tid, NULL, worker, &w[i])) != 0)
+			err(1, "pthread_create");
+	}
+	if (debug) warnx("serving with %d threads%s", nthreads,
+	    shared ? ", one socket each" : "");
+	(void)worker(&w[0]);
+}
@@ -0,0 +1,341 @@
+/*
+ * Request statistics and latency histograms.
+ *
+ * The handlers count each request by procedure and result, and record
+ * how long it took to answer and how long each call to the resolver
+ * took in histograms of power-of-two microsecond buckets.  So that the
+ * counters do not become one more thing for the threads to contend on,
+ * each thread updates a shard of its own (shared round-robin only when
+ * there are more threads than shards), and a report adds them up.
+ *
+ * The report, along with the totals of the caches, can be read from a
+ * Unix domain socket given with -S (e.g., with "nc -U"), and is logged
+ * on SIGUSR1.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "bplog.h"
+#include "bpstats.h"
+#include "dupcache.h"
+#include "replycache.h"
+#include "rescache.h"
+
+#define NSHARDS		16
+#define REPORT_MAX	8192
+
+extern int debug, dolog;
+
+struct shard {
+	u_long	count[BS_NCOUNTERS];
+	u_long	hist[BH_NHIST][BH_BUCKETS];
+	u_long	usec[BH_NHIST];		/* total, for the mean */
+} __attribute__((aligned(64)));
+
+static struct shard shards[NSHARDS];
+static u_int nextshard;
+static pthread_key_t shardkey;
+static pthread_once_t shardonce = PTHREAD_ONCE_INIT;
+static int usr1[2] = { -1, -1 };
+
+static const char *histname[BH_PHASE] = {
+	"whoami", "getfile", "resolver", "getfiles"
+};
+const char *bpstats_phasename[PH_NPHASES] = {
+	"client", "scan", "server", "encode"
+};
+
+static void
+mkkey(void)
+{
+	(void)pthread_key_create(&shardkey, NULL);
+}
+
+/* The shard of the calling thread. */
+static struct shard *
+myshard(void)
+{
+	struct shard *s;
+
+	(void)pthread_once(&shardonce, mkkey);
+	if ((s = pthread_getspecific(shardkey)) == NULL) {
+		s = &shards[__atomic_fetch_add(&nextshard, 1,
+		    __ATOMIC_RELAXED) % NSHARDS];
+		(void)pthread_setspecific(shardkey, s);
+	}
+	return (s);
+}
+
+void
+bpstats_count(int counter)
+{
+	__atomic_fetch_add(&myshard()->count[counter], 1, __ATOMIC_RELAXED);
+}
+
+/* Record that the event counted by histogram 'h' took 'usec'. */
+void
+bpstats_time(int h, u_long usec)
+{
+	struct shard *s = myshard();
+	u_long n = usec;
+	int i = 0;
+
+	while (n && i < BH_BUCKETS - 1) {
+		n >>= 1;
+		i++;
+	}
+	__atomic_fetch_add(&s->hist[h][i], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&s->usec[h], usec, __ATOMIC_RELAXED);
+}
+
+/*
+ * Record the times of the phases of a request to 'h', BH_WHOAMI or
+ * BH_GETFILE, skipping those that are PH_NONE.
+ */
+void
+bpstats_phases(int h, const u_long *phase)
+{
+	int i;
+
+	for (i = 0; i < PH_NPHASES; i++)
+		if (phase[i] != PH_NONE)
+			bpstats_time(BH_PHASE + PH_NPHASES * h + i, phase[i]);
+}
+
+/* Add up the shards into 't'. */
+static void
+total(struct shard *t)
+{
+	const u_long *f;
+	u_long *to = (u_long *)t;
+	size_t i, n = sizeof(*t) / sizeof(u_long);
+	int j;
+
+	memset(t, 0, sizeof(*t));
+	for (j = 0; j < NSHARDS; j++) {
+		f = (const u_long *)&shards[j];
+		for (i = 0; i < n; i++)
+			to[i] += __atomic_load_n(&f[i], __ATOMIC_RELAXED);
+	}
+}
+
+static size_t
+add(char *buf, size_t pos, size_t len, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	if (pos >= len)
+		return (pos);
+	va_start(ap, fmt);
+	n = vsnprintf(buf + pos, len - pos, fmt, ap);
+	va_end(ap);
+	return (n < 0 ? pos : pos + n);
+}
+
+/*
+ * Format the report into 'buf', one line per item.  Returns its length.
+ */
+size_t
+bpstats_format(char *buf, size_t len)
+{
+	struct shard t;
+	const u_long *c = t.count;
+	u_long n, b;
+	size_t pos = 0;
+	int h, i;
+
+	total(&t);
+	pos = add(buf, pos, len, "whoami: %lu cached, %lu answered, "
+	    "%lu failed\n", c[BS_WHOAMI_CACHED], c[BS_WHOAMI_OK],
+	    c[BS_WHOAMI_FAILED]);
+	pos = add(buf, pos, len, "getfile: %lu cached, %lu answered "
+	    "(%lu dump), %lu failed\n", c[BS_GETFILE_CACHED], c[BS_GETFILE_OK],
+	    c[BS_GETFILE_DUMP], c[BS_GETFILE_FAILED]);
+	pos = add(buf, pos, len, "getfiles: %lu calls, %lu found, "
+	    "%lu not found\n", c[BS_GETFILES], c[BS_GETFILES_FOUND],
+	    c[BS_GETFILES_MISSING]);
+	pos = add(buf, pos, len, "resolver: %lu calls, %lu failed\n",
+	    c[BS_RESOLVE], c[BS_RESOLVE_FAILED]);
+	pos = add(buf, pos, len, "resolver cache: %lu hits (%lu negative), "
+	    "%lu misses\n", rescache_stats.hits, rescache_stats.neghits,
+	    rescache_stats.misses);
+	pos = add(buf, pos, len, "reply cache: %lu hits, %lu misses\n",
+	    replycache_stats.hits, replycache_stats.misses);
+	pos = add(buf, pos, len, "duplicates: %lu replayed, %lu dropped\n",
+	    dupcache_stats.replayed, dupcache_stats.dropped);
+	pos = add(buf, pos, len, "log: %lu records, %lu dropped\n",
+	    bplog_stats.logged, bplog_stats.dropped);
+	for (h = 0; h < BH_NHIST; h++) {
+		for (n = 0, i = 0; i < BH_BUCKETS; i++)
+			n += t.hist[h][i];
+		if (h < BH_PHASE)
+			pos = add(buf, pos, len, "%s us: mean %lu",
+			    histname[h], n ? t.usec[h] / n : 0);
+		else if (n == 0)
+			continue;	/* not timing phases */
+		else
+			pos = add(buf, pos, len, "%s %s us: mean %lu",
+			    histname[(h - BH_PHASE) / PH_NPHASES],
+			    bpstats_phasename[(h - BH_PHASE) % PH_NPHASES],
+			    t.usec[h] / n);
+		for (i = 0; i < BH_BUCKETS; i++) {
+			if ((b = t.hist[h][i]) == 0)
+				continue;
+			if (i < 2)
+				pos = add(buf, pos, len, ", %d:%lu", i, b);
+			else if (i == BH_BUCKETS - 1)
+				pos = add(buf, pos, len, ", %lu-:%lu",
+				    1UL << (i - 1), b);
+			else
+				pos = add(buf, pos, len, ", %lu-%lu:%lu",
+				    1UL << (i - 1), (1UL << i) - 1, b);
+		}
+		pos = add(buf, pos, len, "\n");
+	}
+	return (pos < len ? pos : len - 1);
+}
+
+static void
+onusr1(int sig)
+{
+	int save = errno;
+
+	(void)write(usr1[1], "", 1);
+	errno = save;
+}
+
+/* Log the report a line at a time. */
+static void
+logreport(void)
+{
+	char buf[REPORT_MAX], *line, *next;
+
+	(void)bpstats_format(buf, sizeof(buf));
+	for (line = buf; *line; line = next) {
+		if ((next = strchr(line, '\n')) != NULL)
+			*next++ = '\0';
+		else
+			next = line + strlen(line);
+		if (debug)
+			warnx("%s", line);
+		else
+			syslog(LOG_NOTICE, "%s", line);
+	}
+}
+
+static void *
+control(void *arg)
+{
+	struct pollfd pfd[2];
+	char buf[REPORT_MAX];
+	size_t len;
+	ssize_t n;
+	int fd, nfds;
+
+	pfd[0].fd = usr1[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = *(int *)arg;
+	pfd[1].events = POLLIN;
+	nfds = (pfd[1].fd >= 0) ? 2 : 1;
+
+	for (;;) {
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno != EINTR) {
+				if (dolog) syslog(LOG_ERR, "poll: %m");
+				sleep(1);
+			}
+			continue;
+		}
+		if (pfd[0].revents & POLLIN) {
+			(void)read(usr1[0], buf, sizeof(buf));
+			logreport();
+		}
+		if (nfds > 1 && (pfd[1].revents & POLLIN)) {
+			if ((fd = accept(pfd[1].fd, NULL, NULL)) < 0)
+				continue;
+			len = bpstats_format(buf, sizeof(buf));
+			while (len > 0 && (n = write(fd, buf, len)) > 0) {
+				memmove(buf, buf + n, len - n);
+				len -= n;
+			}
+			(void)close(fd);
+		}
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/* Listen for report requests on the Unix domain socket 'path'. */
+static int
+control_socket(const char *path)
+{
+	struct sockaddr_un sun;
+	struct stat st;
+	int s;
+
+	memset(&sun, 0, sizeof(sun));
+	sun.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sun.sun_path))
+		errx(1, "%s: path too long", path);
+	(void)strcpy(sun.sun_path, path);
+	/* remove a socket left behind, but nothing else */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		(void)unlink(path);
+	if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+		err(1, "socket");
+	if (bind(s, (struct sockaddr *)&sun, sizeof(sun)) < 0)
+		err(1, "%s", path);
+	if (listen(s, 8) < 0)
+		err(1, "listen");
+	(void)fcntl(s, F_SETFD, FD_CLOEXEC);
+	return (s);
+}
+
+/*
+ * Start answering report requests on the socket 'path' (if not NULL)
+ * and on SIGUSR1.  Must be called after the daemon has forked.
+ */
+void
+bpstats_start(const char *path)
+{
+	static int cfd = -1;
+	struct sigaction sa;
+	pthread_t tid;
+
+	(void)pthread_once(&shardonce, mkkey);
+	if (path != NULL)
+		cfd = control_socket(path);
+	if (pipe(usr1) < 0)
+		err(1, "pipe");
+	(void)fcntl(usr1[1], F_SETFL, O_NONBLOCK);
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onusr1;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) < 0)
+		err(1, "sigaction");
+	/* a reader going away must not kill the daemon */
+	sa.sa_handler = SIG_IGN;
+	if (sigaction(SIGPIPE, &sa, NULL) < 0)
+		err(1, "sigaction");
+
+	if ((errno = pthread_create(&tid, NULL, control, &cfd)) != 0)
+		err(1, "pthread_create");
+	(void)pthread_detach(tid);
+}
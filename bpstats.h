@@ -0,0 +1,52 @@
+/*
+ * Request statistics and latency histograms, see bpstats.c.
+ */
+
+#ifndef BPSTATS_H
+#define BPSTATS_H
+
+#include <sys/types.h>
+
+extern const char *bpstats_phasename[];
+
+/* counters */
+#define BS_WHOAMI_CACHED	0	/* answered from the reply cache */
+#define BS_WHOAMI_OK		1
+#define BS_WHOAMI_FAILED	2
+#define BS_GETFILE_CACHED	3
+#define BS_GETFILE_OK		4
+#define BS_GETFILE_DUMP		5	/* of the above, empty "dump" answers */
+#define BS_GETFILE_FAILED	6
+#define BS_GETFILES		7	/* version 2 calls */
+#define BS_GETFILES_FOUND	8	/* their file ids */
+#define BS_GETFILES_MISSING	9
+#define BS_RESOLVE		10	/* calls to the resolver */
+#define BS_RESOLVE_FAILED	11
+#define BS_NCOUNTERS		12
+
+/* phases of answering a request, timed with -p */
+#define PH_CLIENT		0	/* finding out who the client is */
+#define PH_SCAN			1	/* looking it up in the database */
+#define PH_SERVER		2	/* resolving the server (GETFILE) */
+#define PH_ENCODE		3	/* encoding the reply */
+#define PH_NPHASES		4
+#define PH_NONE			((u_long)-1)	/* not reached */
+
+/* latency histograms */
+#define BH_WHOAMI		0
+#define BH_GETFILE		1
+#define BH_RESOLVE		2
+#define BH_GETFILES		3
+#define BH_PHASE		4	/* + PH_NPHASES * BH_WHOAMI/GETFILE
+					   + the phase */
+#define BH_NHIST		(BH_PHASE + 2 * PH_NPHASES)
+
+#define BH_BUCKETS		24	/* 0, 1, 2-3, 4-7, ... microseconds */
+
+void bpstats_count(int);
+void bpstats_time(int, u_long);
+void bpstats_phases(int, const u_long *);
+size_t bpstats_format(char *, size_t);
+void bpstats_start(const char *);
+
+#endif /* BPSTATS_H */
@@ -0,0 +1,37 @@
+/*
+ * Monotonic time, see bptime.h.
+ *
+ * OS X before 10.12 has no clock_gettime(), so mach_absolute_time() is
+ * used there; gettimeofday() is the last resort.
+ */
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <mach/mach_time.h>
+#endif
+#include "bptime.h"
+
+/* Microseconds since an arbitrary point, never going backwards. */
+u_int64_t
+bptime_usec(void)
+{
+#if defined(__APPLE__)
+	static mach_timebase_info_data_t tb;
+
+	if (tb.denom == 0)
+		(void)mach_timebase_info(&tb);
+	return (mach_absolute_time() * tb.numer / tb.denom / 1000);
+#elif defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((u_int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+#else
+	struct timeval tv;
+
+	(void)gettimeofday(&tv, NULL);
+	return ((u_int64_t)tv.tv_sec * 1000000 + tv.tv_usec);
+#endif
+}
@@ -0,0 +1,12 @@
+/*
+ * Monotonic time for measuring how long requests take.
+ */
+
+#ifndef BPTIME_H
+#define BPTIME_H
+
+#include <sys/types.h>
+
+u_int64_t bptime_usec(void);
+
+#endif /* BPTIME_H */
@@ -0,0 +1,229 @@
+/*
+ * Tokenizer for bootparams files, see bptok.h.
+ *
+ * A word is a run of non-space characters.  A backslash immediately
+ * followed by a newline joins the lines (ending the word, if inside
+ * one); any other newline ends the entry.  A word starting with '#'
+ * comments out the rest of the entry.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bptok.h"
+
+enum token {
+	T_WORD,
+	T_EOL,
+	T_EOF,
+	T_LONG
+};
+
+/* the characters isspace() accepts in the C locale */
+#define ISSPACE(c)	((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
+
+/* Read all of 'fd', which could not be mapped, into memory. */
+static int
+readall(struct bptok *t, int fd)
+{
+	size_t cap = 65536;
+	ssize_t n;
+	char *buf, *nbuf;
+
+	if ((buf = malloc(cap)) == NULL)
+		return (-1);
+	t->len = 0;
+	while ((n = read(fd, buf + t->len, cap - t->len)) != 0) {
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			free(buf);
+			return (-1);
+		}
+		t->len += n;
+		if (t->len == cap) {
+			if ((nbuf = realloc(buf, cap * 2)) == NULL) {
+				free(buf);
+				return (-1);
+			}
+			buf = nbuf;
+			cap *= 2;
+		}
+	}
+	t->buf = buf;
+	return (0);
+}
+
+/*
+ * Open the file 'path' for tokenizing.  Returns -1 with errno set if it
+ * cannot be read.
+ */
+int
+bptok_open(struct bptok *t, const char *path)
+{
+	struct stat sb;
+	void *map;
+	int fd, save;
+
+	memset(t, 0, sizeof(*t));
+	t->line = 1;
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return (-1);
+	if (fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) && sb.st_size > 0 &&
+	    (map = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) !=
+	    MAP_FAILED) {
+		t->buf = map;
+		t->len = sb.st_size;
+		t->mapped = 1;
+	} else if (readall(t, fd)) {
+		save = errno;
+		(void)close(fd);
+		errno = save;
+		return (-1);
+	}
+	(void)close(fd);
+	t->p = t->buf;
+	return (0);
+}
+
+/*
+ * Tokenize the 'len' bytes at 'buf' instead of a file.  The buffer is
+ * not copied and is left alone by bptok_close().
+ */
+void
+bptok_buf(struct bptok *t, const char *buf, size_t len)
+{
+	memset(t, 0, sizeof(*t));
+	t->line = 1;
+	t->buf = t->p = buf;
+	t->len = len;
+	t->mapped = -1;
+}
+
+void
+bptok_close(struct bptok *t)
+{
+	if (t->mapped > 0)
+		(void)munmap((void *)t->buf, t->len);
+	else if (t->mapped == 0)
+		free((void *)t->buf);
+	t->buf = NULL;
+}
+
+/* Read the next word into t->tok. */
+static enum token
+word(struct bptok *t)
+{
+	const char *p = t->p, *end = t->buf + t->len;
+	size_t len = 0;
+	int ch;
+
+	for (;;) {
+		if (p == end) {
+			t->p = p;
+			return (T_EOF);
+		}
+		ch = (unsigned char)*p++;
+		if (ch == '\n') {
+			t->line++;
+			t->p = p;
+			return (T_EOL);
+		}
+		if (ch == '\\') {
+			if (p < end && *p == '\n') {
+				p++;
+				t->line++;
+				continue;
+			}
+			break;
+		}
+		if (!ISSPACE(ch))
+			break;
+	}
+	for (;;) {
+		if (len == sizeof(t->tok) - 1) {
+			t->p = p;
+			return (T_LONG);
+		}
+		t->tok[len++] = ch;
+		if (p == end)
+			break;
+		ch = (unsigned char)*p;
+		if (ch == '\\' && p + 1 < end && p[1] == '\n') {
+			p += 2;
+			t->line++;
+			break;
+		}
+		if (ISSPACE(ch))
+			break;
+		p++;
+	}
+	t->tok[len] = '\0';
+	t->p = p;
+	return (T_WORD);
+}
+
+/* Skip the rest of the entry. */
+static enum token
+skipentry(struct bptok *t)
+{
+	enum token tk;
+
+	while ((tk = word(t)) == T_WORD || tk == T_LONG)
+		;
+	return (tk);
+}
+
+/*
+ * Return the next record, filling in 'r'.  A word of an entry that is
+ * not key=value is returned as BR_SKIP; it can never be looked up, but
+ * does not spoil the rest of the file.  On BR_ERROR the reason is in
+ * t->err.
+ */
+enum bprec_type
+bptok_next(struct bptok *t, struct bprec *r)
+{
+	enum token tk;
+	char *eq;
+
+	for (;;) {
+		tk = word(t);
+		if (tk == T_EOF)
+			return (BR_EOF);
+		if (tk == T_EOL) {
+			t->inentry = 0;
+			continue;
+		}
+		if (tk == T_LONG) {
+			snprintf(t->err, sizeof(t->err), "line %d: name too long",
+			    t->line);
+			return (BR_ERROR);
+		}
+		if (*t->tok == '#') {
+			t->inentry = 0;
+			if (skipentry(t) == T_EOF)
+				return (BR_EOF);
+			continue;
+		}
+		r->line = t->line;
+		r->name = t->tok;
+		r->value = NULL;
+		if (!t->inentry) {
+			if (*t->tok == '+')
+				return (BR_NIS);
+			t->inentry = 1;
+			return (BR_HOST);
+		}
+		if ((eq = strchr(t->tok, '=')) == NULL || eq == t->tok)
+			return (BR_SKIP);
+		*eq = '\0';
+		r->value = eq + 1;
+		return (BR_PARAM);
+	}
+}
@@ -0,0 +1,49 @@
+/*
+ * Tokenizer for bootparams files.
+ *
+ * The whole file is mapped (or, if it cannot be, read) into memory and
+ * scanned once, producing a record for each host name and each of its
+ * key=value parameters; comments and continuation lines are dealt with
+ * here, so the records are all that the loader needs to look at.
+ */
+
+#ifndef BPTOK_H
+#define BPTOK_H
+
+#include <sys/types.h>
+#include "bootparam_prot.h"
+
+#define BT_TOKLEN	(MAX_FILEID + MAX_MACHINE_NAME + MAX_PATH_LEN + 3)
+
+enum bprec_type {
+	BR_HOST,			/* start of an entry */
+	BR_PARAM,			/* key=value of the current entry */
+	BR_SKIP,			/* other word of the current entry */
+	BR_NIS,				/* the '+' line */
+	BR_EOF,
+	BR_ERROR
+};
+
+struct bprec {
+	int		line;
+	const char	*name;		/* host name or key */
+	const char	*value;		/* of BR_PARAM */
+};
+
+struct bptok {
+	const char	*buf;		/* the file */
+	size_t		len;
+	int		mapped;		/* 1 mapped, 0 read, -1 caller's */
+	const char	*p;		/* next character */
+	int		line;
+	int		inentry;
+	char		tok[BT_TOKLEN + 1];
+	char		err[128];	/* after BR_ERROR */
+};
+
+int bptok_open(struct bptok *, const char *);
+void bptok_buf(struct bptok *, const char *, size_t);
+void bptok_close(struct bptok *);
+enum bprec_type bptok_next(struct bptok *, struct bprec *);
+
+#endif /* BPTOK_H */
@@ -0,0 +1,200 @@
+/*
+ * XDR for the arguments and results of WHOAMI, GETFILE and GETFILES.
+ *
+ * The rpcgen routines go through xdr_string(), which allocates each
+ * decoded string for xdr_free() to release again, and through the XDR
+ * stream's indirect calls for every field.  These decode the argument
+ * strings into fixed buffers bounded by MAX_MACHINE_NAME and MAX_FILEID,
+ * and encode the results directly into the send buffer.  The encoding
+ * is the same as rpcgen's, down to xdr_char() sign-extending the bytes
+ * of an address.
+ */
+
+#include <string.h>
+#include <sys/types.h>
+#include "bootparam_prot.h"
+#include "bpxdr.h"
+
+struct xbuf {
+	u_char	*p;
+	u_char	*end;
+};
+
+static int
+getlong(struct xbuf *x, u_int32_t *v)
+{
+	if (x->end - x->p < 4)
+		return (0);
+	*v = (u_int32_t)x->p[0] << 24 | (u_int32_t)x->p[1] << 16 |
+	    (u_int32_t)x->p[2] << 8 | x->p[3];
+	x->p += 4;
+	return (1);
+}
+
+/* A string of at most 'max' bytes into 's', of at least max + 1. */
+static int
+getstring(struct xbuf *x, char *s, u_int max)
+{
+	u_int32_t n;
+
+	if (!getlong(x, &n) || n > max || (size_t)(x->end - x->p) < RNDUP(n))
+		return (0);
+	memcpy(s, x->p, n);
+	s[n] = '\0';
+	x->p += RNDUP(n);
+	return (1);
+}
+
+static int
+getaddress(struct xbuf *x, bp_address *a)
+{
+	u_int32_t type, c[4];
+
+	if (!getlong(x, &type) || type != IP_ADDR_TYPE ||
+	    !getlong(x, &c[0]) || !getlong(x, &c[1]) ||
+	    !getlong(x, &c[2]) || !getlong(x, &c[3]))
+		return (0);
+	a->address_type = type;
+	a->bp_address_u.ip_addr.net = (char)c[0];
+	a->bp_address_u.ip_addr.host = (char)c[1];
+	a->bp_address_u.ip_addr.lh = (char)c[2];
+	a->bp_address_u.ip_addr.impno = (char)c[3];
+	return (1);
+}
+
+static int
+putlong(struct xbuf *x, u_int32_t v)
+{
+	if (x->end - x->p < 4)
+		return (0);
+	x->p[0] = v >> 24;
+	x->p[1] = v >> 16;
+	x->p[2] = v >> 8;
+	x->p[3] = v;
+	x->p += 4;
+	return (1);
+}
+
+static int
+putstring(struct xbuf *x, const char *s, u_int max)
+{
+	size_t n;
+
+	if (s == NULL || (n = strlen(s)) > max || !putlong(x, n) ||
+	    (size_t)(x->end - x->p) < RNDUP(n))
+		return (0);
+	memcpy(x->p, s, n);
+	memset(x->p + n, 0, RNDUP(n) - n);
+	x->p += RNDUP(n);
+	return (1);
+}
+
+static int
+putaddress(struct xbuf *x, const bp_address *a)
+{
+	const ip_addr_t *ip = &a->bp_address_u.ip_addr;
+
+	return (a->address_type == IP_ADDR_TYPE &&
+	    putlong(x, a->address_type) &&
+	    putlong(x, (int32_t)ip->net) && putlong(x, (int32_t)ip->host) &&
+	    putlong(x, (int32_t)ip->lh) && putlong(x, (int32_t)ip->impno));
+}
+
+static int
+putgetfile(struct xbuf *x, const bp_getfile_res *res)
+{
+	return (putstring(x, res->server_name, MAX_MACHINE_NAME) &&
+	    putaddress(x, &res->server_address) &&
+	    putstring(x, res->server_path, MAX_PATH_LEN));
+}
+
+/*
+ * Decode the argument of 'proc' from the 'len' bytes at 'buf' into
+ * 'args'.  Returns the number of bytes used, or 0 if the argument is
+ * malformed or the procedure is not one of ours.
+ */
+size_t
+bpxdr_decode_arg(u_int32_t proc, const char *buf, size_t len,
+    struct bpxdr_args *args)
+{
+	struct xbuf x;
+	u_int32_t i, n;
+
+	x.p = (u_char *)buf;
+	x.end = x.p + len;
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		if (!getaddress(&x, &args->u.whoami.client_address))
+			return (0);
+		break;
+	case BOOTPARAMPROC_GETFILE:
+		if (!getstring(&x, args->name, MAX_MACHINE_NAME) ||
+		    !getstring(&x, args->fileid, MAX_FILEID))
+			return (0);
+		args->u.getfile.client_name = args->name;
+		args->u.getfile.file_id = args->fileid;
+		break;
+	case BOOTPARAMPROC_GETFILES:
+		if (!getstring(&x, args->name, MAX_MACHINE_NAME) ||
+		    !getlong(&x, &n) || n > MAX_FILEIDS)
+			return (0);
+		for (i = 0; i < n; i++) {
+			if (!getstring(&x, args->fileidbuf[i], MAX_FILEID))
+				return (0);
+			args->fileids[i] = args->fileidbuf[i];
+		}
+		args->u.getfiles.client_name = args->name;
+		args->u.getfiles.file_ids.file_ids_len = n;
+		args->u.getfiles.file_ids.file_ids_val = args->fileids;
+		break;
+	default:
+		return (0);
+	}
+	return (x.p - (u_char *)buf);
+}
+
+/*
+ * Encode the result 'res' of 'proc' into 'buf' of 'len' bytes.  Returns
+ * the length of the encoding, or 0 if it does not fit or the result
+ * cannot be encoded.
+ */
+size_t
+bpxdr_encode_res(u_int32_t proc, char *buf, size_t len, const void *res)
+{
+	const bp_whoami_res *whoami = res;
+	const bp_getfile_res *getfile = res;
+	const bp_getfiles_res *getfiles = res;
+	const bp_getfiles_ent *ent;
+	struct xbuf x;
+	u_int i;
+
+	x.p = (u_char *)buf;
+	x.end = x.p + len;
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		if (!putstring(&x, whoami->client_name, MAX_MACHINE_NAME) ||
+		    !putstring(&x, whoami->domain_name, MAX_MACHINE_NAME) ||
+		    !putaddress(&x, &whoami->router_address))
+			return (0);
+		break;
+	case BOOTPARAMPROC_GETFILE:
+		if (!putgetfile(&x, getfile))
+			return (0);
+		break;
+	case BOOTPARAMPROC_GETFILES:
+		if (getfiles->files.files_len > MAX_FILEIDS ||
+		    !putlong(&x, getfiles->files.files_len))
+			return (0);
+		for (i = 0; i < getfiles->files.files_len; i++) {
+			ent = &getfiles->files.files_val[i];
+			if (!putlong(&x, ent->found ? 1 : 0) ||
+			    (ent->found &&
+			    !putgetfile(&x, &ent->bp_getfiles_ent_u.file)))
+				return (0);
+		}
+		break;
+	default:
+		return (0);
+	}
+	return (x.p - (u_char *)buf);
+}
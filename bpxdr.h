@@ -0,0 +1,28 @@
+/*
+ * XDR for the arguments and results of the bootparam procedures, see
+ * bpxdr.c.
+ */
+
+#ifndef BPXDR_H
+#define BPXDR_H
+
+#include <sys/types.h>
+#include "bootparam_prot.h"
+
+/* decoded arguments of either procedure; the strings point into here */
+struct bpxdr_args {
+	union {
+		bp_whoami_arg	whoami;
+		bp_getfile_arg	getfile;
+		bp_getfiles_arg	getfiles;
+	} u;
+	char	name[MAX_MACHINE_NAME + 1];
+	char	fileid[MAX_FILEID + 1];
+	char	*fileids[MAX_FILEIDS];		/* for GETFILES */
+	char	fileidbuf[MAX_FILEIDS][MAX_FILEID + 1];
+};
+
+size_t bpxdr_decode_arg(u_int32_t, const char *, size_t, struct bpxdr_args *);
+size_t bpxdr_encode_res(u_int32_t, char *, size_t, const void *);
+
+#endif /* BPXDR_H */
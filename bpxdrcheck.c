@@ -0,0 +1,322 @@
+/*
+ * Conformance check of bpxdr.c against the rpcgen codec (make xdrcheck).
+ *
+ * Random arguments of WHOAMI, GETFILE and GETFILES are written out in
+ * XDR without any of the protocol's limits, so that some have oversized
+ * strings, too many file ids or an unknown address type, and are then
+ * decoded both with bpxdr_decode_arg() and with the xdr_bp_* routines
+ * from rpcgen, from the whole encoding and from a truncated prefix of
+ * it.  Random results, again with some strings too long, are encoded
+ * with both into buffers of random size.  The two must agree on whether
+ * each case is valid, and on the bytes used and the values or bytes
+ * produced when it is.
+ */
+
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <rpc/rpc.h>
+#include "bootparam_prot.h"
+#include "bpxdr.h"
+
+#define DEFCASES	200000
+#define BUFSIZE		32768		/* holds any case, even oversized */
+#define OVERSIZE	8		/* how far past a limit strings go */
+
+static u_long ncase, nvalid;
+
+/* A random number in [0, n). */
+static u_int
+rnd(u_int n)
+{
+	return ((u_int)random() % n);
+}
+
+/*
+ * A random string of up to 'max' characters, now and then up to
+ * OVERSIZE longer, into 's' of at least max + OVERSIZE + 1.
+ */
+static char *
+rndstring(char *s, u_int max)
+{
+	u_int i, n;
+
+	n = rnd(8) == 0 ? max + 1 + rnd(OVERSIZE) : rnd(max + 1);
+	if (rnd(4) == 0)
+		n = rnd(8);		/* short ones are the common case */
+	for (i = 0; i < n; i++)
+		s[i] = ' ' + rnd(95);
+	s[n] = '\0';
+	return (s);
+}
+
+static void
+rndaddress(bp_address *a)
+{
+	a->address_type = rnd(16) == 0 ? (int)rnd(4) : IP_ADDR_TYPE;
+	a->bp_address_u.ip_addr.net = (char)rnd(256);
+	a->bp_address_u.ip_addr.host = (char)rnd(256);
+	a->bp_address_u.ip_addr.lh = (char)rnd(256);
+	a->bp_address_u.ip_addr.impno = (char)rnd(256);
+}
+
+/* Raw XDR, without the limits of the protocol. */
+
+static u_char *
+putlong(u_char *p, u_int32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+	return (p + 4);
+}
+
+static u_char *
+putstring(u_char *p, const char *s)
+{
+	size_t n = strlen(s);
+
+	p = putlong(p, n);
+	memcpy(p, s, n);
+	memset(p + n, 0, RNDUP(n) - n);
+	return (p + RNDUP(n));
+}
+
+/* An address, with each byte as any 32-bit value xdr_char() accepts. */
+static u_char *
+putaddress(u_char *p)
+{
+	int i;
+
+	p = putlong(p, rnd(16) == 0 ? rnd(4) : IP_ADDR_TYPE);
+	for (i = 0; i < 4; i++)
+		p = putlong(p, rnd(4) == 0 ? (u_int32_t)random() : rnd(256));
+	return (p);
+}
+
+static int
+sameaddress(const bp_address *a, const bp_address *b)
+{
+	return (a->address_type == b->address_type &&
+	    !memcmp(&a->bp_address_u.ip_addr, &b->bp_address_u.ip_addr,
+	    sizeof(a->bp_address_u.ip_addr)));
+}
+
+/* True if the arguments 'a' and 'b' of 'proc' are the same. */
+static int
+samearg(u_int32_t proc, const void *a, const void *b)
+{
+	const bp_whoami_arg *wa = a, *wb = b;
+	const bp_getfile_arg *ga = a, *gb = b;
+	const bp_getfiles_arg *fa = a, *fb = b;
+	u_int i;
+
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		return (sameaddress(&wa->client_address, &wb->client_address));
+	case BOOTPARAMPROC_GETFILE:
+		return (!strcmp(ga->client_name, gb->client_name) &&
+		    !strcmp(ga->file_id, gb->file_id));
+	}
+	if (strcmp(fa->client_name, fb->client_name) ||
+	    fa->file_ids.file_ids_len != fb->file_ids.file_ids_len)
+		return (0);
+	for (i = 0; i < fa->file_ids.file_ids_len; i++)
+		if (strcmp(fa->file_ids.file_ids_val[i],
+		    fb->file_ids.file_ids_val[i]))
+			return (0);
+	return (1);
+}
+
+static void
+fail(u_int32_t proc, const char *what, long seed)
+{
+	errx(1, "case %lu (proc %u, seed %ld): %s", ncase, proc, seed, what);
+}
+
+/*
+ * Decode the 'len' bytes of an argument of 'proc' at 'buf' with both
+ * codecs and compare.
+ */
+static void
+decode(u_int32_t proc, const u_char *buf, size_t len, long seed)
+{
+	union {
+		bp_whoami_arg	whoami;
+		bp_getfile_arg	getfile;
+		bp_getfiles_arg	getfiles;
+	} ref;
+	struct bpxdr_args args;
+	xdrproc_t proc_xdr;
+	XDR xdrs;
+	size_t used;
+	int ok;
+
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		proc_xdr = (xdrproc_t)xdr_bp_whoami_arg;
+		break;
+	case BOOTPARAMPROC_GETFILE:
+		proc_xdr = (xdrproc_t)xdr_bp_getfile_arg;
+		break;
+	default:
+		proc_xdr = (xdrproc_t)xdr_bp_getfiles_arg;
+		break;
+	}
+	memset(&ref, 0, sizeof(ref));
+	xdrmem_create(&xdrs, (char *)buf, len, XDR_DECODE);
+	ok = proc_xdr(&xdrs, &ref);
+	used = bpxdr_decode_arg(proc, (const char *)buf, len, &args);
+	if (ok != (used != 0))
+		fail(proc, ok ? "rpcgen decoded, bpxdr did not" :
+		    "bpxdr decoded, rpcgen did not", seed);
+	if (ok) {
+		nvalid++;
+		if (used != xdr_getpos(&xdrs) || !samearg(proc, &ref, &args.u))
+			fail(proc, "decodings differ", seed);
+	}
+	xdr_destroy(&xdrs);
+	xdr_free(proc_xdr, (char *)&ref);
+}
+
+static void
+checkarg(u_int32_t proc, long seed)
+{
+	u_char buf[BUFSIZE], *p = buf;
+	char s[MAX_PATH_LEN + OVERSIZE + 1];
+	u_int i, n;
+
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		p = putaddress(p);
+		break;
+	case BOOTPARAMPROC_GETFILE:
+		p = putstring(p, rndstring(s, MAX_MACHINE_NAME));
+		p = putstring(p, rndstring(s, MAX_FILEID));
+		break;
+	default:
+		p = putstring(p, rndstring(s, MAX_MACHINE_NAME));
+		n = rnd(8) == 0 ? MAX_FILEIDS + 1 + rnd(2) :
+		    rnd(MAX_FILEIDS + 1);
+		p = putlong(p, n);
+		for (i = 0; i < n; i++)
+			p = putstring(p, rndstring(s, MAX_FILEID));
+		break;
+	}
+	decode(proc, buf, p - buf, seed);
+	decode(proc, buf, rnd(p - buf), seed);
+}
+
+static void
+checkres(u_int32_t proc, long seed)
+{
+	char name[MAX_FILEIDS][MAX_MACHINE_NAME + OVERSIZE + 1];
+	char path[MAX_FILEIDS][MAX_PATH_LEN + OVERSIZE + 1];
+	bp_getfiles_ent ent[MAX_FILEIDS + 1];
+	bp_whoami_res whoami;
+	bp_getfile_res *f;
+	bp_getfiles_res getfiles;
+	char ref[BUFSIZE], out[BUFSIZE];
+	xdrproc_t proc_xdr;
+	void *res;
+	XDR xdrs;
+	size_t len, used;
+	u_int i;
+	int ok;
+
+	switch (proc) {
+	case BOOTPARAMPROC_WHOAMI:
+		whoami.client_name = rndstring(name[0], MAX_MACHINE_NAME);
+		whoami.domain_name = rndstring(path[0], MAX_MACHINE_NAME);
+		rndaddress(&whoami.router_address);
+		proc_xdr = (xdrproc_t)xdr_bp_whoami_res;
+		res = &whoami;
+		break;
+	case BOOTPARAMPROC_GETFILE:
+	default:
+		getfiles.files.files_len = rnd(16) == 0 ? MAX_FILEIDS + 1 :
+		    1 + rnd(MAX_FILEIDS);
+		getfiles.files.files_val = ent;
+		for (i = 0; i < getfiles.files.files_len; i++) {
+			ent[i].found = proc == BOOTPARAMPROC_GETFILE || rnd(4);
+			f = &ent[i].bp_getfiles_ent_u.file;
+			f->server_name = rndstring(name[i % MAX_FILEIDS],
+			    MAX_MACHINE_NAME);
+			f->server_path = rndstring(path[i % MAX_FILEIDS],
+			    MAX_PATH_LEN);
+			rndaddress(&f->server_address);
+		}
+		if (proc == BOOTPARAMPROC_GETFILE) {
+			proc_xdr = (xdrproc_t)xdr_bp_getfile_res;
+			res = &ent[0].bp_getfiles_ent_u.file;
+		} else {
+			proc_xdr = (xdrproc_t)xdr_bp_getfiles_res;
+			res = &getfiles;
+		}
+		break;
+	}
+	len = rnd(4) == 0 ? rnd(BUFSIZE) : BUFSIZE;
+	xdrmem_create(&xdrs, ref, len, XDR_ENCODE);
+	ok = proc_xdr(&xdrs, res);
+	used = bpxdr_encode_res(proc, out, len, res);
+	if (ok != (used != 0))
+		fail(proc, ok ? "rpcgen encoded, bpxdr did not" :
+		    "bpxdr encoded, rpcgen did not", seed);
+	if (ok) {
+		nvalid++;
+		if (used != xdr_getpos(&xdrs) || memcmp(ref, out, used))
+			fail(proc, "encodings differ", seed);
+	}
+	xdr_destroy(&xdrs);
+}
+
+static void
+usage(void)
+{
+	(void)fprintf(stderr, "usage: bpxdrcheck [-n cases] [-s seed]\n");
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const u_int32_t procs[] = { BOOTPARAMPROC_WHOAMI,
+	    BOOTPARAMPROC_GETFILE, BOOTPARAMPROC_GETFILES };
+	u_long n = DEFCASES;
+	long seed = (long)time(NULL), caseseed;
+	u_int32_t proc;
+	int c;
+
+	while ((c = getopt(argc, argv, "n:s:")) != -1)
+		switch (c) {
+		case 'n':
+			n = strtoul(optarg, NULL, 10);
+			break;
+		case 's':
+			seed = strtol(optarg, NULL, 10);
+			break;
+		default:
+			usage();
+		}
+	if (optind != argc)
+		usage();
+
+	/* each case has a seed of its own, so that it can be run alone */
+	for (ncase = 0; ncase < n; ncase++) {
+		caseseed = seed + ncase;
+		srandom((u_int)caseseed);
+		proc = procs[rnd(3)];
+		if (rnd(2))
+			checkarg(proc, caseseed);
+		else
+			checkres(proc, caseseed);
+	}
+	(void)printf("%lu cases, %lu valid, bpxdr agrees with rpcgen "
+	    "(seed %ld)\n", n, nvalid, seed);
+	return (0);
+}
@@ -0,0 +1,338 @@
+/*
+ * Load generator for bootparamd, "callbootd -b".
+ *
+ * Reads queries from a file, one per line: an IP address for WHOAMI, a
+ * host and a file id for GETFILE, or a host and several file ids for
+ * the version 2 GETFILES.  The calls are encoded once, then sent over
+ * a plain UDP socket round-robin, keeping a given number in flight,
+ * each with an XID of its own, until the duration or the count is
+ * reached.  Calls that get no answer within the timeout (which is how
+ * bootparamd answers a failed lookup) are counted and replaced.  At the
+ * end the throughput, the latency percentiles of the answered calls and
+ * the numbers of errors and timeouts are printed.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <rpc/rpc.h>
+#include <rpc/pmap_clnt.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include "bootparam_prot.h"
+#include "bptime.h"
+
+#define DEFINFLIGHT	16
+#define DEFTIMEOUT	1000		/* ms */
+#define DEFSECS		10
+#define MAXCALL		2048
+
+struct query {
+	char	*call;			/* encoded, XID first */
+	size_t	len;
+};
+
+struct slot {
+	u_int32_t	xid;		/* slot + k * ninflight */
+	u_int64_t	sent;		/* 0 if idle */
+};
+
+static struct query *queries;
+static size_t nqueries;
+static u_int32_t *lat;			/* microseconds of answered calls */
+static size_t nlat, maxlat;
+
+static void
+usage(void)
+{
+	fprintf(stderr,
+	    "usage: callbootd -b [-n inflight] [-c count | -t seconds] "
+	    "[-T timeout_ms]\n"
+	    "                 [-p port] server queryfile\n");
+	exit(1);
+}
+
+/* Encode a call of 'proc' of version 'vers' with argument 'arg'. */
+static void
+addquery(u_long vers, u_long proc, xdrproc_t xarg, void *arg)
+{
+	struct rpc_msg msg;
+	struct query *q;
+	XDR xdrs;
+
+	if ((nqueries & (nqueries - 1)) == 0 && (queries = realloc(queries,
+	    (nqueries ? 2 * nqueries : 1) * sizeof(*queries))) == NULL)
+		err(1, "realloc");
+	q = &queries[nqueries++];
+	if ((q->call = malloc(MAXCALL)) == NULL)
+		err(1, "malloc");
+	memset(&msg, 0, sizeof(msg));
+	msg.rm_direction = CALL;
+	msg.rm_call.cb_rpcvers = RPC_MSG_VERSION;
+	msg.rm_call.cb_prog = BOOTPARAMPROG;
+	msg.rm_call.cb_vers = vers;
+	msg.rm_call.cb_proc = proc;
+	msg.rm_call.cb_cred = _null_auth;
+	msg.rm_call.cb_verf = _null_auth;
+	xdrmem_create(&xdrs, q->call, MAXCALL, XDR_ENCODE);
+	if (!xdr_callmsg(&xdrs, &msg) || !(*xarg)(&xdrs, arg))
+		errx(1, "query %lu does not fit in a call", (u_long)nqueries);
+	q->len = xdr_getpos(&xdrs);
+}
+
+/* Read and encode the queries in 'file'. */
+static void
+readqueries(const char *file)
+{
+	FILE *fp;
+	char line[1024], *word[MAX_FILEIDS + 1], *p;
+	bp_whoami_arg whoami;
+	bp_getfile_arg getfile;
+	bp_getfiles_arg getfiles;
+	in_addr_t addr;
+	int n, lineno = 0;
+
+	if ((fp = fopen(file, "r")) == NULL)
+		err(1, "%s", file);
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		lineno++;
+		if ((p = strchr(line, '#')) != NULL)
+			*p = '\0';
+		for (n = 0, p = strtok(line, " \t\r\n"); p != NULL;
+		    p = strtok(NULL, " \t\r\n")) {
+			if (n == MAX_FILEIDS + 1)
+				errx(1, "%s:%d: too many file ids", file,
+				    lineno);
+			word[n++] = p;
+		}
+		if (n == 0)
+			continue;
+		if (n == 1) {
+			if ((addr = inet_addr(word[0])) == INADDR_NONE)
+				errx(1, "%s:%d: bad address %s", file, lineno,
+				    word[0]);
+			whoami.client_address.address_type = IP_ADDR_TYPE;
+			memcpy(&whoami.client_address.bp_address_u.ip_addr,
+			    &addr, 4);
+			addquery(BOOTPARAMVERS, BOOTPARAMPROC_WHOAMI,
+			    (xdrproc_t)xdr_bp_whoami_arg, &whoami);
+		} else if (n == 2) {
+			getfile.client_name = word[0];
+			getfile.file_id = word[1];
+			addquery(BOOTPARAMVERS, BOOTPARAMPROC_GETFILE,
+			    (xdrproc_t)xdr_bp_getfile_arg, &getfile);
+		} else {
+			getfiles.client_name = word[0];
+			getfiles.file_ids.file_ids_len = n - 1;
+			getfiles.file_ids.file_ids_val = &word[1];
+			addquery(BOOTPARAMVERS2, BOOTPARAMPROC_GETFILES,
+			    (xdrproc_t)xdr_bp_getfiles_arg, &getfiles);
+		}
+	}
+	(void)fclose(fp);
+	if (nqueries == 0)
+		errx(1, "%s: no queries", file);
+}
+
+/*
+ * Check the reply in 'buf', setting 'xid'.  Returns 1 if it is a
+ * successful reply, 0 if an error reply, -1 if not a reply at all.
+ */
+static int
+replystat(const u_char *buf, size_t len, u_int32_t *xid)
+{
+	u_int32_t w[6], vlen;
+	int i;
+
+	if (len < 12)
+		return (-1);
+	for (i = 0; i < 6 && 4 * (size_t)i + 4 <= len; i++) {
+		memcpy(&w[i], buf + 4 * i, 4);
+		w[i] = ntohl(w[i]);
+	}
+	*xid = w[0];
+	if (w[1] != REPLY)
+		return (-1);
+	if (w[2] != MSG_ACCEPTED || len < 20)
+		return (0);
+	vlen = RNDUP(w[4]);
+	if (vlen > MAX_AUTH_BYTES || 20 + vlen + 4 > len)
+		return (0);
+	memcpy(&w[5], buf + 20 + vlen, 4);
+	return (ntohl(w[5]) == SUCCESS);
+}
+
+static int
+cmplat(const void *a, const void *b)
+{
+	u_int32_t x = *(const u_int32_t *)a, y = *(const u_int32_t *)b;
+
+	return (x < y ? -1 : x > y);
+}
+
+static u_int32_t
+percentile(double p)
+{
+	size_t i = (size_t)(p * nlat);
+
+	return (lat[i < nlat ? i : nlat - 1]);
+}
+
+static void
+addlat(u_int64_t usec)
+{
+	if (nlat == maxlat) {
+		maxlat = maxlat ? 2 * maxlat : 65536;
+		if ((lat = realloc(lat, maxlat * sizeof(*lat))) == NULL)
+			err(1, "realloc");
+	}
+	lat[nlat++] = usec > 0xffffffffU ? 0xffffffffU : (u_int32_t)usec;
+}
+
+int
+callbench(int argc, char **argv)
+{
+	struct sockaddr_in sin;
+	struct hostent *he;
+	struct pollfd pfd;
+	struct slot *slots;
+	struct query *q;
+	u_char buf[UDPMSGSIZE];
+	u_int64_t now, start, last, limit, timeout, due;
+	u_long count = 0, sent = 0, done = 0, errors = 0, timeouts = 0;
+	u_int32_t xid, base;
+	size_t next = 0;
+	ssize_t n;
+	int c, i, s, ninflight = DEFINFLIGHT, secs = 0, port = 0, busy, ms;
+
+	timeout = DEFTIMEOUT;
+	while ((c = getopt(argc, argv, "n:c:t:T:p:")) != -1)
+		switch (c) {
+		case 'n':
+			if ((ninflight = atoi(optarg)) < 1)
+				usage();
+			break;
+		case 'c':
+			count = strtoul(optarg, NULL, 10);
+			break;
+		case 't':
+			secs = atoi(optarg);
+			break;
+		case 'T':
+			timeout = strtoul(optarg, NULL, 10);
+			break;
+		case 'p':
+			port = atoi(optarg);
+			break;
+		default:
+			usage();
+		}
+	argc -= optind;
+	argv += optind;
+	if (argc != 2 || timeout == 0)
+		usage();
+	if (count == 0 && secs == 0)
+		secs = DEFSECS;
+	timeout *= 1000;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	if ((sin.sin_addr.s_addr = inet_addr(argv[0])) == INADDR_NONE) {
+		if ((he = gethostbyname(argv[0])) == NULL)
+			errx(1, "no such host %s", argv[0]);
+		memcpy(&sin.sin_addr, he->h_addr, 4);
+	}
+	if (port == 0 && (port = pmap_getport(&sin, BOOTPARAMPROG,
+	    BOOTPARAMVERS, IPPROTO_UDP)) == 0)
+		errx(1, "bootparamd is not registered on %s", argv[0]);
+	sin.sin_port = htons(port);
+	readqueries(argv[1]);
+
+	if ((s = socket(AF_INET, SOCK_DGRAM, 0)) < 0)
+		err(1, "socket");
+	if (connect(s, (struct sockaddr *)&sin, sizeof(sin)) < 0)
+		err(1, "connect");
+	(void)fcntl(s, F_SETFL, O_NONBLOCK);
+	if ((slots = calloc(ninflight, sizeof(*slots))) == NULL)
+		err(1, "calloc");
+	srandom(getpid() ^ time(NULL));
+	base = random();
+	for (i = 0; i < ninflight; i++)
+		slots[i].xid = base + i - ninflight;
+
+	last = start = bptime_usec();
+	limit = secs ? start + (u_int64_t)secs * 1000000 : 0;
+	pfd.fd = s;
+	pfd.events = POLLIN;
+	for (;;) {
+		now = bptime_usec();
+		/* fill the idle slots unless done, noting the next timeout */
+		busy = 0;
+		due = now + timeout;
+		for (i = 0; i < ninflight; i++) {
+			if (slots[i].sent && now - slots[i].sent >= timeout) {
+				timeouts++;
+				slots[i].sent = 0;
+			}
+			if (!slots[i].sent && (count == 0 || sent < count) &&
+			    (limit == 0 || now < limit)) {
+				q = &queries[next];
+				next = (next + 1) % nqueries;
+				slots[i].xid += ninflight;
+				xid = htonl(slots[i].xid);
+				memcpy(q->call, &xid, 4);
+				if (send(s, q->call, q->len, 0) < 0 &&
+				    errno != ENOBUFS && errno != EAGAIN)
+					err(1, "send");
+				slots[i].sent = now;
+				sent++;
+			}
+			if (slots[i].sent) {
+				busy++;
+				if (slots[i].sent + timeout < due)
+					due = slots[i].sent + timeout;
+			}
+		}
+		if (busy == 0)
+			break;
+		ms = (int)((due - now + 999) / 1000);
+		if (poll(&pfd, 1, ms) < 0 && errno != EINTR)
+			err(1, "poll");
+		while ((n = recv(s, buf, sizeof(buf), 0)) >= 0) {
+			if ((c = replystat(buf, n, &xid)) < 0)
+				continue;
+			i = (xid - base) % ninflight;
+			if (!slots[i].sent || slots[i].xid != xid)
+				continue;	/* late, already timed out */
+			last = now = bptime_usec();
+			addlat(now - slots[i].sent);
+			slots[i].sent = 0;
+			done++;
+			if (!c)
+				errors++;
+		}
+	}
+
+	printf("%lu calls in %.2f s: %lu answered (%lu errors), "
+	    "%lu timed out\n", sent, (last - start) / 1e6, done, errors,
+	    timeouts);
+	if (last > start)
+		printf("throughput: %.0f answers/s\n",
+		    done / ((last - start) / 1e6));
+	if (nlat > 0) {
+		qsort(lat, nlat, sizeof(*lat), cmplat);
+		printf("latency us: p50 %u, p99 %u, p999 %u, max %u\n",
+		    percentile(0.5), percentile(0.99), percentile(0.999),
+		    lat[nlat - 1]);
+	}
+	return (timeouts || errors ? 2 : 0);
+}
@@ -35,8 +35,10 @@ char dmn[MAX_MACHINE_NAME+1];
 char path[MAX_PATH_LEN+1];
 extern char *inet_ntoa();
 static void usage(void);
+int callbench(int, char **);
 int printgetfile(bp_getfile_res *);
 int printwhoami(bp_whoami_res *);
+int printgetfiles(bp_getfiles_arg *, bp_getfiles_res *);
 
 bool_t
 eachres_whoami(resultp, raddr)
@@ -66,6 +68,19 @@ struct sockaddr_in *raddr;
   return(0);
 }
 
+bool_t
+eachres_getfiles(resultp, raddr)
+bp_getfiles_res *resultp;
+struct sockaddr_in *raddr;
+{
+  struct hostent *he;
+
+  he = gethostbyaddr((char *)&raddr->sin_addr.s_addr,4,AF_INET);
+  printf("%s answered:\n", he ? he->h_name : inet_ntoa(raddr->sin_addr));
+  printgetfiles(NULL, resultp);
+  printf("\n");
+  return(0);
+}
 
 int
 main(argc, argv)
@@ -78,6 +93,8 @@ char **argv;
   bp_whoami_res *whoami_res, stat_whoami_res;
   bp_getfile_arg getfile_arg;
   bp_getfile_res *getfile_res, stat_getfile_res;
+  bp_getfiles_arg getfiles_arg;
+  bp_getfiles_res *getfiles_res, stat_getfiles_res;
 
 
   long the_inet_addr;
@@ -90,6 +107,8 @@ char **argv;
   stat_getfile_res.server_name = cln;
   stat_getfile_res.server_path = path;
 
+  if (argc > 1 && !strcmp(argv[1], "-b"))
+    exit(callbench(argc - 1, argv + 1));
   if (argc < 3)
     usage();
 
@@ -97,7 +116,9 @@ char **argv;
   if ( ! strcmp(server , "all") ) broadcast = 1;
 
   if ( ! broadcast ) {
-    clnt = clnt_create(server,BOOTPARAMPROG, BOOTPARAMVERS, "udp");
+    /* several file ids are asked for at once with version 2 */
+    clnt = clnt_create(server,BOOTPARAMPROG,
+		       argc > 4 ? BOOTPARAMVERS2 : BOOTPARAMVERS, "udp");
     if ( clnt == NULL )
       errx(1, "could not contact bootparam server on host %s", server);
   }
@@ -153,7 +174,30 @@ char **argv;
 
   default:
 
-    usage();
+    if (argc - 3 > MAX_FILEIDS)
+      usage();
+    getfiles_arg.client_name = argv[2];
+    getfiles_arg.file_ids.file_ids_len = argc - 3;
+    getfiles_arg.file_ids.file_ids_val = &argv[3];
+
+    if (! broadcast ) {
+      getfiles_res = bootparamproc_getfiles_2(&getfiles_arg,clnt);
+      printf("getfiles returning:\n");
+      if (printgetfiles(&getfiles_arg, getfiles_res)) {
+	errx(1, "bad answer returned from server %s", server);
+      } else
+	exit(0);
+    } else {
+      bzero(&stat_getfiles_res, sizeof(stat_getfiles_res));
+      clnt_stat=clnt_broadcast(BOOTPARAMPROG, BOOTPARAMVERS2,
+			       BOOTPARAMPROC_GETFILES,
+			       (xdrproc_t)xdr_bp_getfiles_arg,
+			       (char *)&getfiles_arg,
+			       (xdrproc_t)xdr_bp_getfiles_res,
+			       (char *)&stat_getfiles_res,
+			       eachres_getfiles);
+      exit(0);
+    }
   }
 
 }
@@ -163,9 +207,11 @@ static void
 usage()
 {
 	fprintf(stderr,
-		"usage: callbootd server procnum (IP-addr | host fileid)\n\n" \
+		"usage: callbootd server procnum (IP-addr | host fileid ...)\n\n" \
                 "e.g.:  callbootd 127.0.0.1 mymachine root\n" \
-                "       callbootd 127.0.0.1 192.168.0.101\n");
+                "       callbootd 127.0.0.1 mymachine root swap dump\n" \
+                "       callbootd 127.0.0.1 192.168.0.101\n" \
+                "       callbootd -b [options] server queryfile\n");
     exit(1);
 }
 
@@ -206,3 +252,30 @@ bp_getfile_res *res;
 	return(1);
       }
     }
+
+
+
+int
+printgetfiles(arg, res)
+bp_getfiles_arg *arg;
+bp_getfiles_res *res;
+{
+      bp_getfiles_ent *ent;
+      u_int i;
+
+      if (res) {
+	for (i = 0; i < res->files.files_len; i++) {
+	  ent = &res->files.files_val[i];
+	  if (arg && i < arg->file_ids.file_ids_len)
+	    printf("%s:\n", arg->file_ids.file_ids_val[i]);
+	  if (ent->found)
+	    printgetfile(&ent->bp_getfiles_ent_u.file);
+	  else
+	    printf("not found\n");
+	}
+	return(0);
+      } else {
+	warnx("null answer!!!");
+	return(1);
+      }
+    }
@@ -0,0 +1,311 @@
+/*
+ * Reload the bootparams database when the file changes or on SIGHUP.
+ *
+ * A background thread waits for the file to change (inotify on Linux,
+ * kqueue on BSD and OS X) or for SIGHUP, lets a burst of changes settle
+ * and then calls the reload function, which parses the file and
+ * publishes the result with bpdb_publish().  It can also be asked to
+ * reload at an interval, for data such as the NIS map that cannot be
+ * watched.
+ */
+
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <libgen.h>
+#define HAVE_INOTIFY
+#elif defined(__APPLE__) || defined(__FreeBSD__) || defined(__NetBSD__) || \
+    defined(__OpenBSD__) || defined(__DragonFly__)
+#include <sys/event.h>
+#include <sys/time.h>
+#define HAVE_KQUEUE
+#endif
+#include "dbwatch.h"
+
+#define SETTLE_MS	200		/* wait for writes to finish */
+#define RETRY_MS	1000		/* while the file is missing */
+
+extern int debug, dolog;
+
+static int hup[2] = { -1, -1 };
+static const char *dbfile;
+static int (*reload)(void);
+static pthread_mutex_t refresh_lock = PTHREAD_MUTEX_INITIALIZER;
+static int refresh;		/* seconds, 0 for none */
+static time_t lastload;
+
+static void
+onhup(int sig)
+{
+	int save = errno;
+
+	(void)write(hup[1], "", 1);
+	errno = save;
+}
+
+#ifdef HAVE_INOTIFY
+static char *dbdir, *dbbase;
+
+static int
+watch_open(void)
+{
+	char *s;
+	int fd;
+
+	if ((s = strdup(dbfile)) == NULL || (dbbase = strdup(dbfile)) == NULL)
+		return (-1);
+	dbdir = dirname(s);
+	dbbase = basename(dbbase);
+	if ((fd = inotify_init()) < 0)
+		return (-1);
+	/* Watch the directory so that files replaced by rename are seen. */
+	if (inotify_add_watch(fd, dbdir, IN_CLOSE_WRITE | IN_MOVED_TO |
+	    IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+		(void)close(fd);
+		return (-1);
+	}
+	return (fd);
+}
+
+/* Read pending events, return true if any of them was for the file. */
+static int
+watch_changed(int fd)
+{
+	char buf[4096];
+	const struct inotify_event *ev;
+	ssize_t n, i;
+	int changed = 0;
+
+	if ((n = read(fd, buf, sizeof(buf))) <= 0)
+		return (0);
+	for (i = 0; i < n; i += sizeof(*ev) + ev->len) {
+		ev = (const struct inotify_event *)(buf + i);
+		if (ev->len && !strcmp(ev->name, dbbase))
+			changed = 1;
+	}
+	return (changed);
+}
+
+static int
+watch_missing(void)
+{
+	return (0);
+}
+
+#elif defined(HAVE_KQUEUE)
+static int kq = -1, vfd = -1;
+
+/* (Re)attach the vnode filter to the file, which may have been replaced. */
+static void
+watch_file(void)
+{
+	struct kevent ev;
+
+	if (vfd >= 0)
+		(void)close(vfd);
+	if ((vfd = open(dbfile, O_RDONLY)) < 0)
+		return;
+	EV_SET(&ev, vfd, EVFILT_VNODE, EV_ADD | EV_CLEAR,
+	    NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME,
+	    0, NULL);
+	if (kevent(kq, &ev, 1, NULL, 0, NULL) < 0) {
+		(void)close(vfd);
+		vfd = -1;
+	}
+}
+
+static int
+watch_open(void)
+{
+	if ((kq = kqueue()) < 0)
+		return (-1);
+	watch_file();
+	return (kq);
+}
+
+static int
+watch_changed(int fd)
+{
+	struct timespec ts = { 0, 0 };
+	struct kevent ev;
+
+	if (kevent(fd, NULL, 0, &ev, 1, &ts) <= 0)
+		return (0);
+	if (ev.fflags & (NOTE_DELETE | NOTE_RENAME))
+		watch_file();
+	return (1);
+}
+
+/* If the file went away, see if it is back; true if it is. */
+static int
+watch_missing(void)
+{
+	if (vfd >= 0)
+		return (0);
+	watch_file();
+	return (vfd >= 0);
+}
+
+#else
+static int
+watch_open(void)
+{
+	return (-1);
+}
+
+static int
+watch_changed(int fd)
+{
+	return (0);
+}
+
+static int
+watch_missing(void)
+{
+	return (0);
+}
+#endif
+
+/* Milliseconds until a periodic reload is due, or -1 if none is. */
+static int
+refresh_due(void)
+{
+	time_t now;
+	int ms = -1;
+
+	pthread_mutex_lock(&refresh_lock);
+	if (refresh > 0) {
+		now = time(NULL);
+		ms = (lastload + refresh > now) ?
+		    (int)(lastload + refresh - now) * 1000 : 0;
+	}
+	pthread_mutex_unlock(&refresh_lock);
+	return (ms);
+}
+
+static void
+doreload(void)
+{
+	pthread_mutex_lock(&refresh_lock);
+	lastload = time(NULL);
+	pthread_mutex_unlock(&refresh_lock);
+	(void)reload();
+}
+
+static void *
+watcher(void *arg)
+{
+	struct pollfd pfd[2];
+	int n, nfds, timeout, due, pending = 0;
+	char buf[16];
+
+	pfd[0].fd = hup[0];
+	pfd[0].events = POLLIN;
+	pfd[1].fd = *(int *)arg;
+	pfd[1].events = POLLIN;
+	nfds = (pfd[1].fd >= 0) ? 2 : 1;
+
+	for (;;) {
+		timeout = pending ? SETTLE_MS :
+#ifdef HAVE_KQUEUE
+		    (vfd < 0) ? RETRY_MS :
+#endif
+		    -1;
+		if ((due = refresh_due()) >= 0 &&
+		    (timeout < 0 || due < timeout))
+			timeout = due;
+		n = poll(pfd, nfds, timeout);
+		if (n < 0) {
+			if (errno != EINTR) {
+				if (dolog) syslog(LOG_ERR, "poll: %m");
+				sleep(1);
+			}
+			continue;
+		}
+		if (n == 0) {
+			if (watch_missing())
+				pending = 1;
+			else if (pending) {
+				pending = 0;
+				doreload();
+			} else if (refresh_due() == 0) {
+				if (debug) warnx("refreshing %s", dbfile);
+				doreload();
+			}
+			continue;
+		}
+		if (pfd[0].revents & POLLIN) {
+			(void)read(hup[0], buf, sizeof(buf));
+			if (debug) warnx("SIGHUP, reloading %s", dbfile);
+			pending = 0;
+			doreload();
+		}
+		if (nfds > 1 && (pfd[1].revents & POLLIN) &&
+		    watch_changed(pfd[1].fd))
+			pending = 1;
+	}
+	/* NOTREACHED */
+	return (NULL);
+}
+
+/*
+ * Reload every 'secs' seconds (counting from the latest load) as well
+ * as on changes, or only on changes if 'secs' is 0.  May be called at
+ * any time, including from the reload function.
+ */
+void
+dbwatch_refresh(int secs)
+{
+	pthread_mutex_lock(&refresh_lock);
+	refresh = secs;
+	if (lastload == 0)
+		lastload = time(NULL);
+	pthread_mutex_unlock(&refresh_lock);
+}
+
+/*
+ * Start watching 'file', calling 'func' to reload it.  Must be called
+ * after the daemon has forked.
+ */
+void
+dbwatch_start(const char *file, int (*func)(void))
+{
+	static int wfd;
+	struct sigaction sa;
+	pthread_t tid;
+
+	dbfile = file;
+	reload = func;
+	if (pipe(hup) < 0)
+		err(1, "pipe");
+	(void)fcntl(hup[1], F_SETFL, O_NONBLOCK);
+	if ((wfd = watch_open()) < 0) {
+		if (debug) warnx("not watching %s, reload with SIGHUP", file);
+		if (dolog)
+			syslog(LOG_NOTICE, "not watching %s, reload with SIGHUP",
+			    file);
+	}
+
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler = onhup;
+	sa.sa_flags = SA_RESTART;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGHUP, &sa, NULL) < 0)
+		err(1, "sigaction");
+
+	if ((errno = pthread_create(&tid, NULL, watcher, &wfd)) != 0)
+		err(1, "pthread_create");
+	(void)pthread_detach(tid);
+}
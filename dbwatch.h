@@ -0,0 +1,11 @@
+/*
+ * Background reloading of the bootparams database, see dbwatch.c.
+ */
+
+#ifndef DBWATCH_H
+#define DBWATCH_H
+
+void dbwatch_start(const char *, int (*)(void));
+void dbwatch_refresh(int);
+
+#endif /* DBWATCH_H */
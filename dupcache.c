@@ -0,0 +1,158 @@
+/*
+ * Duplicate request cache, see dupcache.h.
+ *
+ * Calls are kept in a set-associative table like the other caches, a
+ * new call taking the place of an expired or else the oldest entry of
+ * its set.  A reply too large to keep is not replayed; its duplicates
+ * are answered normally.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "dupcache.h"
+#include "replycache.h"
+
+#define DC_WAYS		4
+#define DC_MAXREPLY	(4 + RP_MAXBODY)
+
+struct dc_entry {
+	time_t		expires;	/* 0 if unused */
+	in_addr_t	addr;
+	in_port_t	port;
+	int		busy;		/* no reply yet */
+	u_int32_t	xid;		/* as received */
+	u_int32_t	proc;
+	size_t		len;		/* of the reply, 0 for none */
+	char		reply[DC_MAXREPLY];
+};
+
+struct dupcache_stats dupcache_stats;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct dc_entry *tab;
+static u_int nsets;
+static int ttl = DC_DEFTTL;
+
+/*
+ * Set up a cache of 'size' calls, each kept for 'secs' seconds after it
+ * was received.  A size of zero disables it.
+ */
+void
+dupcache_init(u_int size, int secs)
+{
+	free(tab);
+	tab = NULL;
+	ttl = secs;
+	nsets = (size + DC_WAYS - 1) / DC_WAYS;
+	if (nsets == 0 || ttl <= 0) {
+		nsets = 0;
+		return;
+	}
+	if ((tab = calloc(nsets * DC_WAYS, sizeof(*tab))) == NULL)
+		err(1, "duplicate request cache");
+}
+
+static struct dc_entry *
+findset(const struct sockaddr_in *from, u_int32_t xid)
+{
+	u_int32_t hash;
+
+	hash = (xid ^ from->sin_addr.s_addr ^ from->sin_port) * 2654435761U;
+	return (&tab[(hash % nsets) * DC_WAYS]);
+}
+
+static struct dc_entry *
+find(struct dc_entry *set, const struct sockaddr_in *from, u_int32_t xid,
+    u_int32_t proc, time_t now)
+{
+	struct dc_entry *e;
+
+	for (e = set; e < set + DC_WAYS; e++)
+		if (e->expires > now && e->xid == xid && e->proc == proc &&
+		    e->addr == from->sin_addr.s_addr &&
+		    e->port == from->sin_port)
+			return (e);
+	return (NULL);
+}
+
+/*
+ * Check the call 'xid', 'proc' (both as received) from 'from'.  Returns
+ * DC_NEW if it has not been seen, in which case dupcache_done() must be
+ * called when it has been answered, DC_BUSY if it is being answered,
+ * or DC_REPLAY after copying the reply to 'reply' (of at least
+ * UDPMSGSIZE bytes) and its length to '*len'.
+ */
+int
+dupcache_check(const struct sockaddr_in *from, u_int32_t xid, u_int32_t proc,
+    char *reply, size_t *len)
+{
+	struct dc_entry *e, *set, *old;
+	time_t now;
+	int r;
+
+	if (nsets == 0)
+		return (DC_NEW);
+	now = time(NULL);
+	pthread_mutex_lock(&lock);
+	set = findset(from, xid);
+	if ((e = find(set, from, xid, proc, now)) != NULL) {
+		if (e->busy) {
+			dupcache_stats.dropped++;
+			r = DC_BUSY;
+		} else {
+			dupcache_stats.replayed++;
+			memcpy(reply, e->reply, e->len);
+			*len = e->len;
+			r = DC_REPLAY;
+		}
+		pthread_mutex_unlock(&lock);
+		return (r);
+	}
+	for (e = old = set; e < set + DC_WAYS; e++) {
+		if (e->expires <= now)
+			break;
+		if (e->expires < old->expires)
+			old = e;
+	}
+	if (e == set + DC_WAYS)
+		e = old;
+	e->expires = now + ttl;
+	e->addr = from->sin_addr.s_addr;
+	e->port = from->sin_port;
+	e->xid = xid;
+	e->proc = proc;
+	e->busy = 1;
+	e->len = 0;
+	pthread_mutex_unlock(&lock);
+	return (DC_NEW);
+}
+
+/*
+ * Record the reply of 'len' bytes to a call for which dupcache_check()
+ * returned DC_NEW.  If no reply was sent ('len' is zero) or it is too
+ * large to keep, the call is forgotten.
+ */
+void
+dupcache_done(const struct sockaddr_in *from, u_int32_t xid, u_int32_t proc,
+    const char *reply, size_t len)
+{
+	struct dc_entry *e;
+
+	if (nsets == 0)
+		return;
+	pthread_mutex_lock(&lock);
+	if ((e = find(findset(from, xid), from, xid, proc, time(NULL))) !=
+	    NULL && e->busy) {
+		if (len == 0 || len > sizeof(e->reply))
+			e->expires = 0;
+		else {
+			memcpy(e->reply, reply, len);
+			e->len = len;
+			e->busy = 0;
+		}
+	}
+	pthread_mutex_unlock(&lock);
+}
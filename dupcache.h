@@ -0,0 +1,40 @@
+/*
+ * Duplicate request cache for bootparamd.
+ *
+ * Boot PROMs retransmit on short fixed timers, so a busy server sees
+ * the same call (same client address and port, XID and procedure)
+ * several times.  The native server remembers each call for a while:
+ * a duplicate of one still being answered is dropped, and one of a
+ * call already answered gets the same reply again without running the
+ * handler.  A call that got no reply is forgotten, so that its
+ * retransmissions are answered if, say, the client has since been
+ * added to the file.
+ */
+
+#ifndef DUPCACHE_H
+#define DUPCACHE_H
+
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define DC_DEFSIZE	256		/* calls remembered */
+#define DC_DEFTTL	10		/* seconds */
+
+#define DC_NEW		0		/* not seen, now in progress */
+#define DC_BUSY		1		/* still in progress, drop */
+#define DC_REPLAY	2		/* answered, replay the reply */
+
+struct dupcache_stats {
+	u_long	replayed;		/* duplicates answered from the cache */
+	u_long	dropped;		/* duplicates in progress */
+};
+
+extern struct dupcache_stats dupcache_stats;
+
+void dupcache_init(u_int, int);
+int dupcache_check(const struct sockaddr_in *, u_int32_t, u_int32_t,
+    char *, size_t *);
+void dupcache_done(const struct sockaddr_in *, u_int32_t, u_int32_t,
+    const char *, size_t);
+
+#endif /* DUPCACHE_H */
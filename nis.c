@@ -0,0 +1,221 @@
+/*
+ * NIS bootparams map access, see nis.h.
+ *
+ * The yp client is not thread-safe, so all calls to it are serialized.
+ * The cache of single lookups is organized like the resolver cache.
+ * Without YP every lookup fails.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef YP
+#include <rpc/rpc.h>
+#include <rpcsvc/yp_prot.h>
+#include <rpcsvc/ypclnt.h>
+#endif
+#include "bootparam_prot.h"
+#include "nis.h"
+
+#define NIS_MAP		"bootparams"
+#define NC_WAYS		4
+
+extern int debug;
+
+#ifdef YP
+struct nc_entry {
+	time_t		expires;	/* 0 if unused */
+	u_int32_t	hash;
+	int		found;
+	char		key[MAX_MACHINE_NAME + 1];
+	char		val[NIS_MAXVAL + 1];
+};
+
+struct allctx {
+	nis_func	func;
+	void		*arg;
+	int		failed;
+};
+
+static pthread_mutex_t yp_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct nc_entry *tab;
+static u_int nsets;
+static int ttl, negttl;
+
+static u_int32_t
+hashstr(const char *s)
+{
+	u_int32_t h = 2166136261U;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/* Look 'key' up in the map, without the cache. */
+static int
+match(const char *key, char *val, size_t len)
+{
+	char *domain, *result;
+	int rlen, rv = -1;
+
+	pthread_mutex_lock(&yp_lock);
+	if (yp_get_default_domain(&domain)) {
+		if (debug) warnx("NIS: no default domain");
+	} else if (!yp_match(domain, NIS_MAP, key, strlen(key), &result,
+	    &rlen)) {
+		snprintf(val, len, "%.*s", rlen, result);
+		free(result);
+		rv = 0;
+	}
+	pthread_mutex_unlock(&yp_lock);
+	return (rv);
+}
+#endif
+
+/*
+ * Set up a cache of 'size' lookups, keeping found keys for 'pttl' and
+ * missing ones for 'nttl' seconds.
+ */
+void
+nis_init(u_int size, int pttl, int nttl)
+{
+#ifdef YP
+	free(tab);
+	tab = NULL;
+	ttl = pttl;
+	negttl = nttl;
+	nsets = (size + NC_WAYS - 1) / NC_WAYS;
+	if (nsets == 0)
+		return;
+	if ((tab = calloc(nsets * NC_WAYS, sizeof(*tab))) == NULL)
+		err(1, "NIS cache");
+#else
+	(void)size;
+	(void)pttl;
+	(void)nttl;
+#endif
+}
+
+/*
+ * Copy the value of 'key' in the bootparams map to 'val'.  Returns 0 if
+ * found and -1 if not (or if there is no NIS).
+ */
+int
+nis_match(const char *key, char *val, size_t len)
+{
+#ifdef YP
+	struct nc_entry *e, *set, *old;
+	char rval[NIS_MAXVAL + 1];
+	u_int32_t hash;
+	time_t now;
+	int found;
+
+	if (strlen(key) > MAX_MACHINE_NAME)
+		return (-1);
+	hash = hashstr(key);
+	now = time(NULL);
+	if (nsets) {
+		pthread_mutex_lock(&lock);
+		set = &tab[(hash % nsets) * NC_WAYS];
+		for (e = set; e < set + NC_WAYS; e++)
+			if (e->expires > now && e->hash == hash &&
+			    !strcmp(e->key, key)) {
+				if ((found = e->found))
+					snprintf(val, len, "%s", e->val);
+				pthread_mutex_unlock(&lock);
+				return (found ? 0 : -1);
+			}
+		pthread_mutex_unlock(&lock);
+	}
+
+	rval[0] = '\0';
+	found = !match(key, rval, sizeof(rval));
+	if (nsets) {
+		pthread_mutex_lock(&lock);
+		set = old = &tab[(hash % nsets) * NC_WAYS];
+		for (e = set; e < set + NC_WAYS; e++) {
+			if (e->expires <= now)
+				break;
+			if (e->expires < old->expires)
+				old = e;
+		}
+		if (e == set + NC_WAYS)
+			e = old;
+		e->hash = hash;
+		e->found = found;
+		snprintf(e->key, sizeof(e->key), "%s", key);
+		snprintf(e->val, sizeof(e->val), "%s", rval);
+		e->expires = now + (found ? ttl : negttl);
+		if (e->expires <= now)
+			e->expires = 0;
+		pthread_mutex_unlock(&lock);
+	}
+	if (!found)
+		return (-1);
+	snprintf(val, len, "%s", rval);
+	return (0);
+#else
+	(void)key;
+	(void)val;
+	(void)len;
+	return (-1);
+#endif
+}
+
+#ifdef YP
+static int
+foreach(int status, char *key, int keylen, char *val, int vallen, char *data)
+{
+	struct allctx *ctx = (struct allctx *)data;
+
+	if (status != YP_TRUE) {
+		if (status != YP_NOMORE)
+			ctx->failed = 1;
+		return (1);
+	}
+	if ((*ctx->func)(ctx->arg, key, keylen, val, vallen)) {
+		ctx->failed = 1;
+		return (1);
+	}
+	return (0);
+}
+#endif
+
+/*
+ * Call 'func' with each key and value of the bootparams map; it may
+ * return non-zero to give up.  Returns 0 if the whole map was read, -1
+ * if it could not be.
+ */
+int
+nis_all(nis_func func, void *arg)
+{
+#ifdef YP
+	struct ypall_callback cb;
+	struct allctx ctx;
+	char *domain;
+	int rv = -1;
+
+	ctx.func = func;
+	ctx.arg = arg;
+	ctx.failed = 0;
+	cb.foreach = foreach;
+	cb.data = (char *)&ctx;
+	pthread_mutex_lock(&yp_lock);
+	if (!yp_get_default_domain(&domain) &&
+	    !yp_all(domain, NIS_MAP, &cb) && !ctx.failed)
+		rv = 0;
+	pthread_mutex_unlock(&yp_lock);
+	return (rv);
+#else
+	(void)func;
+	(void)arg;
+	return (-1);
+#endif
+}
@@ -0,0 +1,24 @@
+/*
+ * Access to the NIS bootparams map, used after a '+' line in the
+ * bootparams file when bootparamd is built with -DYP.
+ *
+ * The map is normally read whole with nis_all() when the database is
+ * loaded.  If that fails, single keys are looked up with nis_match(),
+ * whose answers are cached like those of the resolver.
+ */
+
+#ifndef NIS_H
+#define NIS_H
+
+#include <sys/types.h>
+
+#define NIS_MAXVAL	1024		/* YPMAXRECORD */
+#define NIS_DEFREFRESH	300		/* seconds between map reloads */
+
+typedef int (*nis_func)(void *, const char *, size_t, const char *, size_t);
+
+void nis_init(u_int, int, int);
+int nis_match(const char *, char *, size_t);
+int nis_all(nis_func, void *);
+
+#endif /* NIS_H */
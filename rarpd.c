@@ -69,57 +69,173 @@ char copyright[] = "@(#) Copyright (c) 1990 The Regents of the University of Cal
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/time.h>
-#include <net/bpf.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
 #include <net/if.h>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/if_arp.h>
+#include <netinet/ether.h>
+#include <grp.h>
+#include <sys/epoll.h>
+#include <sys/inotify.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#define HAVE_PACKET_RING
+#define HAVE_EPOLL
+#define HAVE_NETLINK
+#define ARPOP_REVREQUEST ARPOP_RREQUEST
+#define ARPOP_REVREPLY ARPOP_RREPLY
+#define IFREQ_LEN(ifr) sizeof(struct ifreq)
+#else
+#include <net/bpf.h>
+#include <sys/event.h>
+#include <net/route.h>
 #include <net/if_dl.h>
 #include <net/if_types.h>
+#define IFREQ_LEN(ifr) (sizeof((ifr)->ifr_name) + (ifr)->ifr_addr.sa_len)
+#endif
 #include <netinet/in.h>
 #include <netinet/if_ether.h>
 #include <sys/errno.h>
 #include <sys/file.h>
+#include <fcntl.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include <dirent.h>
 #include <pwd.h>
+#include <ctype.h>
 
 #ifndef ETHER_ADDR_LEN
 #define ETHER_ADDR_LEN 6
 #endif
 
+#ifdef HAVE_PACKET_RING
+/*
+ * The receive ring of each interface: TPACKET_V3 blocks that the kernel
+ * fills with frames and hands over whole, retiring a partly filled block
+ * after RING_TIMEOUT so that a lone request is not kept waiting.
+ */
+#define RING_BLOCKS 8
+#define RING_BLOCKSIZE (1 << 16)        /* a multiple of the page size */
+#define RING_FRAMESIZE 2048
+#define RING_TIMEOUT 10                 /* milliseconds */
+
+typedef struct sock_filter rarp_insn;
+#else
+typedef struct bpf_insn rarp_insn;
+#endif
+
+#define MAX_EVENTS 64                   /* interfaces ready per wakeup */
+
+#ifndef ETHERS_FILE
+#define ETHERS_FILE "/etc/ethers"
+#endif
+#ifndef HOSTS_FILE
+#define HOSTS_FILE "/etc/hosts"
+#endif
+#define SETTLE_MS 200                   /* wait for writes to finish */
+#define RELOAD_ETHERS 0x01              /* the watched files changed */
+#define RELOAD_IFADDRS 0x02             /* interface addresses changed */
+
+/*
+ * The hosts of ETHERS_FILE, hashed by Ethernet address with open
+ * addressing.  Each bucket is one cache line of keys, the address in
+ * the low 48 bits with EB_USED set, and the hosts are in a parallel
+ * array, so a request is answered with a single probe as long as the
+ * table is at most half full.  The IP addresses of each host are
+ * resolved when the table is built.
+ */
+#define EB_SLOTS 8                      /* keys per bucket */
+#define EB_USED ((u_int64_t)1 << 48)
+#define EH_ADDRS 4                      /* addresses kept per host */
+
+struct ether_bucket {
+    u_int64_t eb_key[EB_SLOTS];         /* 0 if the slot is empty */
+} __attribute__((aligned(64)));
+
+struct ether_host {
+    char *eh_name;
+    u_int32_t eh_addr[EH_ADDRS];        /* network order, 0 after the last */
+};
+
+struct ether_table {
+    struct ether_bucket *et_bucket;
+    struct ether_host *et_host;         /* EB_SLOTS for each bucket */
+    u_int et_mask;                      /* number of buckets - 1 */
+    u_int et_count;
+};
+
+/*
+ * The IP addresses that have a boot file in the tftp directory, i.e.,
+ * the names there that start with eight upper case hexadecimal digits,
+ * as an open addressing set of the addresses with TS_USED set.  It is
+ * read when needed after the directory has changed.
+ */
+#define TS_USED ((u_int64_t)1 << 32)
+
+struct tftp_set {
+    u_int64_t *ts_key;                  /* 0 if the slot is empty */
+    u_int ts_mask;                      /* number of slots - 1 */
+};
+
 enum err_fatality {
     NONFATAL = 0,
     FATAL
 };
 
+/*
+ * A reply ready to be sent, built when the tables are.
+ */
+#define RARP_LEN (sizeof(struct ether_header) + sizeof(struct ether_arp))
+
+struct rarp_frame {
+    u_char rf_data[RARP_LEN];           /* Ethernet header and RARP reply */
+    u_int32_t rf_ipaddr;                /* the address given, network order */
+};
+
 /*
  * The structure for each interface.
  */
 struct if_info {
-    int ii_fd;                          /* BPF file descriptor */
+    int ii_fd;                          /* BPF file descriptor or socket */
     u_char ii_eaddr[ETHER_ADDR_LEN];    /* Ethernet address of this interface */
     u_long ii_ipaddr;                   /* IP address of this interface */
     u_long ii_netmask;                  /* subnet or net mask */
+#ifdef HAVE_PACKET_RING
+    u_char *ii_ring;                    /* mapped receive ring */
+    u_int ii_block;                     /* next block to look at */
+#endif
+    struct ether_bucket *ii_bucket;     /* hosts on this net, as in ethers */
+    struct rarp_frame *ii_frame;        /* their replies, by slot */
+    u_int ii_mask;                      /* number of buckets - 1 */
+    char ii_name[IFNAMSIZ];
     struct if_info *ii_next;
 };
 
 /*
  * The list of all interfaces that are being listened to.  rarp_loop()
- * "selects" on the descriptors in this list.
+ * waits on the descriptors in this list.
  */
 struct if_info *iflist;
 
-int rarp_open(const char * const);
+void rarp_open(struct if_info * const, const char * const);
+void rarp_read(struct if_info * const);
 int rarp_bootable(const u_long);
 void init_one(const char * const);
 void init_all(void);
 void rarp_loop(void);
-void lookup_eaddr(const char * const, u_char * const);
-void lookup_ipaddr(const char * const, u_long * const, u_long * const);
+void ethers_load(void);
+void refresh_ifaddrs(void);
+int lookup_eaddr(const char * const, u_char * const, const enum err_fatality);
+int lookup_ipaddr(const char * const, u_long * const, u_long * const, const enum err_fatality);
 void usage(void);
 void rarp_process(const struct if_info * const, u_char * const);
-void rarp_reply(const struct if_info * const, struct ether_header * const, const u_long);
+void rarp_frames(struct if_info * const);
+void rarp_reply(const struct if_info * const, struct rarp_frame * const, const u_char * const, const u_long);
+void rarp_send(const struct if_info * const, const struct rarp_frame * const);
 void update_arptab(const u_char * const , const u_long);
 void err(const enum err_fatality, const char *, ...);
 void debug(const char *, ...);
@@ -135,6 +251,9 @@ int bflag = 0;                  /* boot everything (skip tftp file check) */
 #endif
 
 static const char *tftp_dir = TFTP_DIR;
+static struct ether_table ethers;
+static struct tftp_set tftp_files;
+static int tftp_loaded = 0;             /* 0 to read tftp_dir again */
 
 int main(int argc, char **argv) {
     int op, pid, devnull, f;
@@ -262,9 +381,39 @@ void init_one(const char * const ifname) {
     p->ii_next = iflist;
     iflist = p;
 
-    p->ii_fd = rarp_open(ifname);
-    lookup_eaddr(ifname, p->ii_eaddr);
-    lookup_ipaddr(ifname, &p->ii_ipaddr, &p->ii_netmask);
+    p->ii_bucket = 0;
+    p->ii_frame = 0;
+    p->ii_mask = 0;
+    (void)strncpy(p->ii_name, ifname, sizeof p->ii_name - 1);
+    p->ii_name[sizeof p->ii_name - 1] = '\0';
+    rarp_open(p, ifname);
+    (void)lookup_eaddr(ifname, p->ii_eaddr, FATAL);
+    (void)lookup_ipaddr(ifname, &p->ii_ipaddr, &p->ii_netmask, FATAL);
+}
+
+/*
+ * Get the system configuration list of interfaces into 'ifc', growing
+ * the buffer until the whole list fits.  The caller frees ifc_buf.
+ */
+static void get_ifconf(const int fd, struct ifconf * const ifc, const char * const caller) {
+    int size = 8192;
+
+    ifc->ifc_buf = 0;
+    while (1) {
+        if ((ifc->ifc_buf = realloc(ifc->ifc_buf, size)) == 0) {
+            err(FATAL, "malloc: %s", strerror(errno));
+            /* NOTREACHED */
+        }
+        ifc->ifc_len = size;
+        if (ioctl(fd, SIOCGIFCONF, (caddr_t) ifc) < 0 || ifc->ifc_len < (int)sizeof(struct ifreq)) {
+            err(FATAL, "%s: SIOCGIFCONF: %s", caller, strerror(errno));
+            /* NOTREACHED */
+        }
+        /* A buffer that is nearly full may have been cut short. */
+        if (ifc->ifc_len <= size / 2)
+            return;
+        size *= 2;
+    }
 }
 
 /*
@@ -273,7 +422,6 @@ void init_one(const char * const ifname) {
  * point to point.
  */
 void init_all() {
-    char inbuf[8192];
     struct ifconf ifc;
     struct ifreq *ifr;
     int fd;
@@ -284,15 +432,10 @@ void init_all() {
         /* NOTREACHED */
     }
 
-    ifc.ifc_len = sizeof(inbuf);
-    ifc.ifc_buf = inbuf;
-    if (ioctl(fd, SIOCGIFCONF, (caddr_t) & ifc) < 0 || ifc.ifc_len < sizeof(struct ifreq)) {
-        err(FATAL, "init_all: SIOCGIFCONF: %s", strerror(errno));
-        /* NOTREACHED */
-    }
+    get_ifconf(fd, &ifc, "init_all");
     ifr = ifc.ifc_req;
     for (i = 0; i < ifc.ifc_len; i += len, ifr = (struct ifreq *)((caddr_t) ifr + len)) {
-        len = sizeof(ifr->ifr_name) + ifr->ifr_addr.sa_len;
+        len = IFREQ_LEN(ifr);
         if (ioctl(fd, SIOCGIFFLAGS, (caddr_t) ifr) < 0) {
             err(FATAL, "init_all: SIOCGIFFLAGS: %s", strerror(errno));
             /* NOTREACHED */
@@ -301,6 +444,7 @@ void init_all() {
             continue;
         init_one(ifr->ifr_name);
     }
+    free(ifc.ifc_buf);
     (void)close(fd);
 }
 
@@ -310,6 +454,161 @@ void usage() {
     exit(1);
 }
 
+/*
+ * Perform various sanity checks on the RARP request packet.  Return
+ * false on failure and log the reason.
+ */
+static int rarp_check(const u_char * const p, const int len) {
+    struct ether_header *ep = (struct ether_header *)p;
+    struct ether_arp *ap = (struct ether_arp *)(p + sizeof(*ep));
+
+    if (len < (int)(sizeof(*ep) + sizeof(*ap))) {
+        err(NONFATAL, "truncated request");
+        return 0;
+    }
+    (void)debug("got request for %02X:%02X:%02X:%02X:%02X:%02X", (unsigned)ap->arp_sha[0], (unsigned)ap->arp_sha[1], (unsigned)ap->arp_sha[2], (unsigned)ap->arp_sha[3], (unsigned)ap->arp_sha[4], (unsigned)ap->arp_sha[5]
+        );
+
+    /* XXX This test might be better off broken out... */
+    if (ntohs(ep->ether_type) != ETHERTYPE_REVARP || ntohs(ap->arp_hrd) != ARPHRD_ETHER || ntohs(ap->arp_op) != ARPOP_REVREQUEST || ntohs(ap->arp_pro) != ETHERTYPE_IP || ap->arp_hln != ETHER_ADDR_LEN || ap->arp_pln != 4) {
+        err(NONFATAL, "request fails sanity check");
+        return 0;
+    }
+    if (bcmp(&ep->ether_shost, &ap->arp_sha, ETHER_ADDR_LEN) != 0) {
+        err(NONFATAL, "ether/arp sender address mismatch");
+        return 0;
+    }
+    if (bcmp(&ap->arp_sha, &ap->arp_tha, ETHER_ADDR_LEN) != 0) {
+        err(NONFATAL, "ether/arp target address mismatch");
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * The filter that accepts only RARP requests, as a BPF program on BSD
+ * and OS X and as a socket filter on Linux.
+ */
+static rarp_insn rarp_filter[] = {
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_REVARP, 0, 3),
+    BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+    BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REVREQUEST, 0, 1),
+    BPF_STMT(BPF_RET | BPF_K, sizeof(struct ether_arp) + sizeof(struct ether_header)),
+    BPF_STMT(BPF_RET | BPF_K, 0),
+};
+
+#ifdef HAVE_PACKET_RING
+/*
+ * Open an AF_PACKET socket on the interface named 'device', set the
+ * filter that accepts only RARP requests, and map its receive ring.
+ */
+void rarp_open(struct if_info * const ii, const char * const device) {
+    int fd;
+    struct ifreq ifr;
+    struct sockaddr_ll sll;
+    struct tpacket_req3 req;
+    int version = TPACKET_V3;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    u_int i;
+    struct sock_fprog filter = {
+        sizeof rarp_filter / sizeof(rarp_filter[0]),
+        rarp_filter
+    };
+
+    /* No protocol until bound, so nothing from other interfaces is queued. */
+    if ((fd = socket(AF_PACKET, SOCK_RAW, 0)) < 0) {
+        err(FATAL, "socket: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    (void)strncpy(ifr.ifr_name, device, sizeof ifr.ifr_name);
+    /* Check that the data link layer is an Ethernet; this code won't work
+     * with anything else. */
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        err(FATAL, "SIOCGIFHWADDR: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    if (ifr.ifr_hwaddr.sa_family != ARPHRD_ETHER) {
+        err(FATAL, "%s is not an ethernet", device);
+        /* NOTREACHED */
+    }
+    if (ioctl(fd, SIOCGIFINDEX, &ifr) < 0) {
+        err(FATAL, "SIOCGIFINDEX: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+        err(FATAL, "SO_ATTACH_FILTER: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        err(FATAL, "PACKET_VERSION: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    bzero(&req, sizeof(req));
+    req.tp_block_size = RING_BLOCKSIZE;
+    req.tp_block_nr = RING_BLOCKS;
+    req.tp_frame_size = RING_FRAMESIZE;
+    req.tp_frame_nr = RING_BLOCKS * (RING_BLOCKSIZE / RING_FRAMESIZE);
+    req.tp_retire_blk_tov = RING_TIMEOUT;
+    if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) < 0) {
+        err(FATAL, "PACKET_RX_RING: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    ii->ii_ring = mmap(NULL, RING_BLOCKS * RING_BLOCKSIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ii->ii_ring == MAP_FAILED) {
+        err(FATAL, "mmap: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    /* Only the status of each block, in its first page, is written to
+     * hand it back to the kernel; the rest of the ring is only read. */
+    for (i = 0; pagesize > 0 && pagesize < RING_BLOCKSIZE && i < RING_BLOCKS; ++i) {
+        if (mprotect(ii->ii_ring + i * RING_BLOCKSIZE + pagesize, RING_BLOCKSIZE - pagesize, PROT_READ) < 0) {
+            err(FATAL, "mprotect: %s", strerror(errno));
+            /* NOTREACHED */
+        }
+    }
+    ii->ii_block = 0;
+
+    bzero(&sll, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETHERTYPE_REVARP);
+    sll.sll_ifindex = ifr.ifr_ifindex;
+    if (bind(fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+        err(FATAL, "bind: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    ii->ii_fd = fd;
+}
+
+/*
+ * Process the requests in the blocks of the ring of 'ii' that the kernel
+ * has handed over, then give the blocks back.  The requests are not
+ * copied out of the ring, and nothing is written to it but the block
+ * status: the replies were built beforehand by rarp_frames().
+ */
+void rarp_read(struct if_info * const ii) {
+    struct tpacket_block_desc *bd;
+    struct tpacket3_hdr *hp;
+    u_char *pkt;
+    u_int n;
+
+    while (1) {
+        bd = (struct tpacket_block_desc *)(ii->ii_ring + ii->ii_block * RING_BLOCKSIZE);
+        if (!(__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER))
+            break;
+        hp = (struct tpacket3_hdr *)((u_char *)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for (n = bd->hdr.bh1.num_pkts; n > 0; --n) {
+            pkt = (u_char *)hp + hp->tp_mac;
+            if (rarp_check(pkt, hp->tp_snaplen))
+                rarp_process(ii, pkt);
+            hp = (struct tpacket3_hdr *)((u_char *)hp + hp->tp_next_offset);
+        }
+        __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        ii->ii_block = (ii->ii_block + 1) % RING_BLOCKS;
+    }
+}
+
+#else
 static int bpf_open() {
     int fd;
     int n = 0;
@@ -332,23 +631,15 @@ static int bpf_open() {
  * Open a BPF file and attach it to the interface named 'device'.
  * Set immediate mode, and set a filter that accepts only RARP requests.
  */
-int rarp_open(const char * const device) {
+void rarp_open(struct if_info * const ii, const char * const device) {
     int fd;
     struct ifreq ifr;
     u_int dlt;
     int immediate;
 
-    static struct bpf_insn insns[] = {
-        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
-        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETHERTYPE_REVARP, 0, 3),
-        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
-        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ARPOP_REVREQUEST, 0, 1),
-        BPF_STMT(BPF_RET | BPF_K, sizeof(struct ether_arp) + sizeof(struct ether_header)),
-        BPF_STMT(BPF_RET | BPF_K, 0),
-    };
     static struct bpf_program filter = {
-        sizeof insns / sizeof(insns[0]),
-        insns
+        sizeof rarp_filter / sizeof(rarp_filter[0]),
+        rarp_filter
     };
 
     fd = bpf_open();
@@ -359,6 +650,11 @@ int rarp_open(const char * const device) {
         err(FATAL, "BIOCIMMEDIATE: %s", strerror(errno));
         /* NOTREACHED */
     }
+    /* Non-blocking, so that rarp_read() can drain it. */
+    if (ioctl(fd, FIONBIO, &immediate) < 0) {
+        err(FATAL, "FIONBIO: %s", strerror(errno));
+        /* NOTREACHED */
+    }
     (void)strncpy(ifr.ifr_name, device, sizeof ifr.ifr_name);
     if (ioctl(fd, BIOCSETIF, (caddr_t) & ifr) < 0) {
         err(FATAL, "BIOCSETIF: %s", strerror(errno));
@@ -379,174 +675,603 @@ int rarp_open(const char * const device) {
         err(FATAL, "BIOCSETF: %s", strerror(errno));
         /* NOTREACHED */
     }
-    return fd;
+    ii->ii_fd = fd;
 }
 
 /*
- * Perform various sanity checks on the RARP request packet.  Return
- * false on failure and log the reason.
+ * Read the requests waiting on the BPF file of 'ii' and process them,
+ * until there are no more.
  */
-static int rarp_check(const u_char * const p, const int len) {
-    struct ether_header *ep = (struct ether_header *)p;
-    struct ether_arp *ap = (struct ether_arp *)(p + sizeof(*ep));
+void rarp_read(struct if_info * const ii) {
+    static u_char *buf;
+    static int bufsize;
+    u_char *bp, *ep;
+    int cc, fd = ii->ii_fd;
 
-    if (len < sizeof(*ep) + sizeof(*ap)) {
-        err(NONFATAL, "truncated request");
-        return 0;
+    if (buf == 0) {
+        if (ioctl(fd, BIOCGBLEN, (caddr_t) & bufsize) < 0) {
+            err(FATAL, "BIOCGBLEN: %s", strerror(errno));
+            /* NOTREACHED */
+        }
+        buf = (u_char *) malloc((unsigned)bufsize);
+        if (buf == 0) {
+            err(FATAL, "malloc: %s", strerror(errno));
+            /* NOTREACHED */
+        }
     }
-    (void)debug("got request for %02X:%02X:%02X:%02X:%02X:%02X", (unsigned)ap->arp_sha[0], (unsigned)ap->arp_sha[1], (unsigned)ap->arp_sha[2], (unsigned)ap->arp_sha[3], (unsigned)ap->arp_sha[4], (unsigned)ap->arp_sha[5]
-        );
+again:
+    cc = read(fd, buf, bufsize);
+    /* Don't choke when we get ptraced */
+    if (cc < 0 && errno == EINTR)
+        goto again;
+    /* Drained, or the descriptor has gone away. */
+    if (cc == 0 || (cc < 0 && errno == EAGAIN))
+        return;
+    /* Due to a SunOS bug, after 2^31 bytes, the file
+     * offset overflows and read fails with EINVAL.  The
+     * lseek() to 0 will fix things. */
+    if (cc < 0) {
+        if (errno == EINVAL && (lseek(fd, 0, SEEK_CUR) + bufsize) < 0) {
+            (void)lseek(fd, 0, 0);
+            goto again;
+        }
+        err(FATAL, "read: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    /* Loop through the packet(s) */
+#define bhp ((struct bpf_hdr *)bp)
+    bp = buf;
+    ep = bp + cc;
+    while (bp < ep) {
+        register int caplen, hdrlen;
+
+        caplen = bhp->bh_caplen;
+        hdrlen = bhp->bh_hdrlen;
+        if (rarp_check(bp + hdrlen, caplen))
+            rarp_process(ii, bp + hdrlen);
+        bp += BPF_WORDALIGN(hdrlen + caplen);
+    }
+    goto again;
+}
+#endif
 
-    /* XXX This test might be better off broken out... */
-    if (ntohs(ep->ether_type) != ETHERTYPE_REVARP || ntohs(ap->arp_hrd) != ARPHRD_ETHER || ntohs(ap->arp_op) != ARPOP_REVREQUEST || ntohs(ap->arp_pro) != ETHERTYPE_IP || ap->arp_hln != ETHER_ADDR_LEN || ap->arp_pln != 4) {
-        err(NONFATAL, "request fails sanity check");
-        return 0;
+/*
+ * Watch the files the ethers table is built from, so that it can be
+ * rebuilt when they change: their directories with inotify on Linux,
+ * the files themselves with kqueue on BSD and OS X.  The events of the
+ * watch carry no interface.
+ */
+static const char * const watched[] = { ETHERS_FILE, HOSTS_FILE };
+#define NWATCHED (sizeof(watched) / sizeof(watched[0]))
+
+#ifdef HAVE_EPOLL
+static int watch_fd = -1;
+static int tftp_wd = -1;
+
+static void watch_start(const int qfd) {
+    struct epoll_event ev;
+    char dir[256], *p;
+    u_int i;
+
+    if ((watch_fd = inotify_init1(IN_NONBLOCK)) < 0) {
+        err(NONFATAL, "inotify_init1: %s", strerror(errno));
+        return;
     }
-    if (bcmp(&ep->ether_shost, &ap->arp_sha, ETHER_ADDR_LEN) != 0) {
-        err(NONFATAL, "ether/arp sender address mismatch");
-        return 0;
+    for (i = 0; i < NWATCHED; ++i) {
+        (void)snprintf(dir, sizeof(dir), "%s", watched[i]);
+        if ((p = strrchr(dir, '/')) != 0)
+            *p = '\0';
+        /* Watch the directory so that files replaced by rename are seen. */
+        if (inotify_add_watch(watch_fd, *dir ? dir : "/", IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_ATTRIB) < 0)
+            err(NONFATAL, "cannot watch %s: %s", watched[i], strerror(errno));
     }
-    if (bcmp(&ap->arp_sha, &ap->arp_tha, ETHER_ADDR_LEN) != 0) {
-        err(NONFATAL, "ether/arp target address mismatch");
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = 0;
+    if (epoll_ctl(qfd, EPOLL_CTL_ADD, watch_fd, &ev) < 0) {
+        err(FATAL, "epoll_ctl: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+}
+
+/*
+ * Watch tftp_dir for files coming and going, as of now.
+ */
+static void watch_tftp() {
+    if (watch_fd >= 0)
+        tftp_wd = inotify_add_watch(watch_fd, tftp_dir, IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF);
+}
+
+/*
+ * Read the pending events of the watch; true if any of them was for
+ * one of the watched files.  Changes to tftp_dir have it read again.
+ */
+static int watch_changed(const struct epoll_event * const ev) {
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *iev;
+    const char *base;
+    ssize_t n, i;
+    u_int j;
+    int changed = 0;
+
+    (void)ev;                           /* all events are on watch_fd */
+    while ((n = read(watch_fd, buf, sizeof(buf))) > 0) {
+        for (i = 0; i < n; i += sizeof(*iev) + iev->len) {
+            iev = (const struct inotify_event *)(buf + i);
+            if (iev->wd == tftp_wd) {
+                tftp_loaded = 0;
+                continue;
+            }
+            for (j = 0; j < NWATCHED && iev->len; ++j) {
+                base = strrchr(watched[j], '/');
+                if (strcmp(iev->name, base ? base + 1 : watched[j]) == 0)
+                    changed = 1;
+            }
+        }
+    }
+    return changed;
+}
+
+static void watch_reopen() {
+}
+
+#else
+static int watch_fd[NWATCHED];
+static int watch_q = -1;
+static int tftp_fd = -1;
+
+/*
+ * (Re)attach the vnode filter to each of the files, which may have
+ * been replaced or have appeared since.
+ */
+static void watch_reopen() {
+    struct kevent ev;
+    u_int i;
+
+    for (i = 0; i < NWATCHED; ++i) {
+        if (watch_fd[i] >= 0)
+            (void)close(watch_fd[i]);
+        if ((watch_fd[i] = open(watched[i], O_RDONLY)) < 0)
+            continue;
+        EV_SET(&ev, watch_fd[i], EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_EXTEND | NOTE_ATTRIB | NOTE_DELETE | NOTE_RENAME, 0, 0);
+        if (kevent(watch_q, &ev, 1, NULL, 0, NULL) < 0) {
+            (void)close(watch_fd[i]);
+            watch_fd[i] = -1;
+        }
+    }
+}
+
+static void watch_start(const int qfd) {
+    u_int i;
+
+    watch_q = qfd;
+    for (i = 0; i < NWATCHED; ++i)
+        watch_fd[i] = -1;
+    watch_reopen();
+}
+
+/*
+ * Watch tftp_dir for files coming and going, as of now.
+ */
+static void watch_tftp() {
+    struct kevent ev;
+
+    if (tftp_fd >= 0)
+        (void)close(tftp_fd);
+    if ((tftp_fd = open(tftp_dir, O_RDONLY)) < 0)
+        return;
+    EV_SET(&ev, tftp_fd, EVFILT_VNODE, EV_ADD | EV_CLEAR, NOTE_WRITE | NOTE_DELETE | NOTE_RENAME, 0, 0);
+    if (kevent(watch_q, &ev, 1, NULL, 0, NULL) < 0) {
+        (void)close(tftp_fd);
+        tftp_fd = -1;
+    }
+}
+
+/*
+ * True if 'ev' is for one of the watched files.  Changes to tftp_dir
+ * have it read again.
+ */
+static int watch_changed(const struct kevent * const ev) {
+    if ((int)ev->ident == tftp_fd) {
+        tftp_loaded = 0;
         return 0;
     }
     return 1;
 }
+#endif
+
+/*
+ * Listen to the kernel for interfaces changing their addresses, so
+ * that the replies built with the old ones are built again.  The
+ * events of the socket are marked with the address of route_fd.
+ */
+static int route_fd = -1;
+
+static void route_start(const int qfd) {
+#ifdef HAVE_NETLINK
+    struct sockaddr_nl nl;
+    struct epoll_event ev;
+
+    if ((route_fd = socket(AF_NETLINK, SOCK_RAW, NETLINK_ROUTE)) < 0) {
+        err(NONFATAL, "socket: %s", strerror(errno));
+        return;
+    }
+    bzero(&nl, sizeof(nl));
+    nl.nl_family = AF_NETLINK;
+    nl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    if (bind(route_fd, (struct sockaddr *)&nl, sizeof(nl)) < 0) {
+        err(NONFATAL, "bind: %s", strerror(errno));
+        (void)close(route_fd);
+        route_fd = -1;
+        return;
+    }
+    (void)fcntl(route_fd, F_SETFL, fcntl(route_fd, F_GETFL) | O_NONBLOCK);
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = &route_fd;
+    if (epoll_ctl(qfd, EPOLL_CTL_ADD, route_fd, &ev) < 0) {
+        err(FATAL, "epoll_ctl: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+#else
+    struct kevent ev;
+
+    if ((route_fd = socket(PF_ROUTE, SOCK_RAW, AF_INET)) < 0) {
+        err(NONFATAL, "socket: %s", strerror(errno));
+        return;
+    }
+    (void)fcntl(route_fd, F_SETFL, fcntl(route_fd, F_GETFL) | O_NONBLOCK);
+    EV_SET(&ev, route_fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, &route_fd);
+    if (kevent(qfd, &ev, 1, NULL, 0, NULL) < 0) {
+        err(FATAL, "kevent: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+#endif
+}
+
+/*
+ * Read the pending messages of the routing socket; true if any of them
+ * was about the addresses or state of an interface.
+ */
+static int route_changed() {
+    char buf[8192] __attribute__((aligned(8)));
+    ssize_t n;
+    int changed = 0;
+#ifdef HAVE_NETLINK
+    const struct nlmsghdr *nh;
+#else
+    const struct rt_msghdr *rtm;
+    ssize_t i;
+#endif
+
+    while ((n = read(route_fd, buf, sizeof(buf))) > 0) {
+#ifdef HAVE_NETLINK
+        for (nh = (const struct nlmsghdr *)buf; NLMSG_OK(nh, (size_t)n); nh = NLMSG_NEXT(nh, n)) {
+            if (nh->nlmsg_type == RTM_NEWADDR || nh->nlmsg_type == RTM_DELADDR || nh->nlmsg_type == RTM_NEWLINK)
+                changed = 1;
+        }
+#else
+        for (i = 0; i + (ssize_t)sizeof(*rtm) <= n && (rtm = (const struct rt_msghdr *)(buf + i))->rtm_msglen; i += rtm->rtm_msglen) {
+            if (rtm->rtm_type == RTM_NEWADDR || rtm->rtm_type == RTM_DELADDR || rtm->rtm_type == RTM_IFINFO)
+                changed = 1;
+        }
+#endif
+    }
+    return changed;
+}
+
+static long now_ms() {
+    struct timeval tv;
+
+    (void)gettimeofday(&tv, 0);
+    return tv.tv_sec * 1000L + tv.tv_usec / 1000;
+}
 
 /*
  * Loop indefinitely listening for RARP requests on the
- * interfaces in 'iflist'.
+ * interfaces in 'iflist'.  Each descriptor is registered once,
+ * with the interface it belongs to, so a wakeup leads straight
+ * to the interfaces that have requests however many there are.
+ * The events are edge-triggered, so rarp_read() drains each one.
+ * When the watched files change, the ethers table is rebuilt once
+ * they have not changed for SETTLE_MS, and likewise the replies of
+ * the interfaces whose addresses changed.
  */
 void rarp_loop() {
-    u_char *buf, *bp, *ep;
-    int cc, fd;
-    fd_set fds, listeners;
-    int bufsize, maxfd = 0;
+    int qfd, i, n, timeout, pending = 0;
+    long due = 0;
     struct if_info *ii;
+#ifdef HAVE_EPOLL
+    struct epoll_event ev, events[MAX_EVENTS];
+#else
+    struct kevent ev, events[MAX_EVENTS];
+    struct timespec ts;
+#endif
 
     if (iflist == 0) {
         err(FATAL, "no interfaces");
         /* NOTREACHED */
     }
-    if (ioctl(iflist->ii_fd, BIOCGBLEN, (caddr_t) & bufsize) < 0) {
-        err(FATAL, "BIOCGBLEN: %s", strerror(errno));
+#ifdef HAVE_EPOLL
+    if ((qfd = epoll_create1(0)) < 0) {
+        err(FATAL, "epoll_create1: %s", strerror(errno));
         /* NOTREACHED */
     }
-    buf = (u_char *) malloc((unsigned)bufsize);
-    if (buf == 0) {
-        err(FATAL, "malloc: %s", strerror(errno));
+    for (ii = iflist; ii; ii = ii->ii_next) {
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = ii;
+        if (epoll_ctl(qfd, EPOLL_CTL_ADD, ii->ii_fd, &ev) < 0) {
+            err(FATAL, "epoll_ctl: %s", strerror(errno));
+            /* NOTREACHED */
+        }
+    }
+#else
+    if ((qfd = kqueue()) < 0) {
+        err(FATAL, "kqueue: %s", strerror(errno));
         /* NOTREACHED */
     }
-    /*
-     * Find the highest numbered file descriptor for select().
-     * Initialize the set of descriptors to listen to.
-     */
-    FD_ZERO(&fds);
     for (ii = iflist; ii; ii = ii->ii_next) {
-        FD_SET(ii->ii_fd, &fds);
-        if (ii->ii_fd > maxfd)
-            maxfd = ii->ii_fd;
+        EV_SET(&ev, ii->ii_fd, EVFILT_READ, EV_ADD | EV_CLEAR, 0, 0, ii);
+        if (kevent(qfd, &ev, 1, NULL, 0, NULL) < 0) {
+            err(FATAL, "kevent: %s", strerror(errno));
+            /* NOTREACHED */
+        }
     }
+#endif
+    watch_start(qfd);
+    route_start(qfd);
+    ethers_load();
     while (1) {
-        listeners = fds;
-        if (select(maxfd + 1, &listeners, (struct fd_set *)0, (struct fd_set *)0, (struct timeval *)0) < 0) {
-            err(FATAL, "select: %s", strerror(errno));
+        timeout = -1;
+        if (pending && (timeout = due - now_ms()) < 0)
+            timeout = 0;
+#ifdef HAVE_EPOLL
+        n = epoll_wait(qfd, events, MAX_EVENTS, timeout);
+#else
+        ts.tv_sec = timeout / 1000;
+        ts.tv_nsec = (timeout % 1000) * 1000000L;
+        n = kevent(qfd, NULL, 0, events, MAX_EVENTS, pending ? &ts : NULL);
+#endif
+        if (n < 0) {
+            /* Don't choke when we get ptraced */
+            if (errno == EINTR)
+                continue;
+            err(FATAL, "wait: %s", strerror(errno));
             /* NOTREACHED */
         }
-        for (ii = iflist; ii; ii = ii->ii_next) {
-            fd = ii->ii_fd;
-            if (!FD_ISSET(fd, &listeners))
-                continue;
-        again:
-            cc = read(fd, buf, bufsize);
-            /* Don't choke when we get ptraced */
-            if (cc < 0 && errno == EINTR)
-                goto again;
-            /* Due to a SunOS bug, after 2^31 bytes, the file
-             * offset overflows and read fails with EINVAL.  The
-             * lseek() to 0 will fix things. */
-            if (cc < 0) {
-                if (errno == EINVAL && (lseek(fd, 0, SEEK_CUR) + bufsize) < 0) {
-                    (void)lseek(fd, 0, 0);
-                    goto again;
+        for (i = 0; i < n; ++i) {
+#ifdef HAVE_EPOLL
+            ii = (struct if_info *)events[i].data.ptr;
+#else
+            ii = (struct if_info *)events[i].udata;
+#endif
+            if ((void *)ii == (void *)&route_fd) {
+                if (route_changed()) {
+                    pending |= RELOAD_IFADDRS;
+                    due = now_ms() + SETTLE_MS;
                 }
-                err(FATAL, "read: %s", strerror(errno));
-                /* NOTREACHED */
-            }
-            /* Loop through the packet(s) */
-#define bhp ((struct bpf_hdr *)bp)
-            bp = buf;
-            ep = bp + cc;
-            while (bp < ep) {
-                register int caplen, hdrlen;
-
-                caplen = bhp->bh_caplen;
-                hdrlen = bhp->bh_hdrlen;
-                if (rarp_check(bp + hdrlen, caplen))
-                    rarp_process(ii, bp + hdrlen);
-                bp += BPF_WORDALIGN(hdrlen + caplen);
+            } else if (ii)
+                rarp_read(ii);
+            else if (watch_changed(&events[i])) {
+                pending |= RELOAD_ETHERS;
+                due = now_ms() + SETTLE_MS;
             }
         }
+        if (pending && now_ms() >= due) {
+            if (pending & RELOAD_ETHERS) {
+                watch_reopen();
+                /* Rebuilds the replies of every interface. */
+                if (pending & RELOAD_IFADDRS)
+                    refresh_ifaddrs();
+                ethers_load();
+            } else
+                refresh_ifaddrs();
+            pending = 0;
+        }
     }
 }
 
+static u_int hash64(const u_int64_t key) {
+    return (u_int)((key * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/*
+ * Read the names in tftp_dir into a new set of the addresses that have
+ * a boot file, in place of the previous one.  Returns the number of
+ * names in the directory, or -1 if it cannot be read.
+ */
+static int tftp_load() {
+    struct dirent *dent;
+    DIR *d;
+    u_int64_t *keys, key;
+    u_int size = 64, mask, slot, n = 0;
+    int i, files = 0;
+    char hex[9];
+
+    watch_tftp();
+    if ((d = opendir(tftp_dir)) == 0)
+        return -1;
+    while ((dent = readdir(d)))
+        ++files;
+    /* Enough slots to keep the set at most half full. */
+    while (size < 2 * (u_int)files)
+        size <<= 1;
+    mask = size - 1;
+    if ((keys = (u_int64_t *)calloc(size, sizeof(*keys))) == 0) {
+        err(FATAL, "malloc: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    rewinddir(d);
+    while ((dent = readdir(d))) {
+        for (i = 0; i < 8; ++i) {
+            if (!isxdigit((u_char)dent->d_name[i]) || islower((u_char)dent->d_name[i]))
+                break;
+        }
+        if (i < 8)
+            continue;
+        bcopy(dent->d_name, hex, 8);
+        hex[8] = '\0';
+        key = TS_USED | strtoul(hex, NULL, 16);
+        for (slot = hash64(key) & mask; keys[slot] && keys[slot] != key; slot = (slot + 1) & mask)
+            ;
+        if (keys[slot] == 0) {
+            keys[slot] = key;
+            ++n;
+        }
+    }
+    (void)closedir(d);
+    free(tftp_files.ts_key);
+    tftp_files.ts_key = keys;
+    tftp_files.ts_mask = mask;
+    debug("%u boot files in %s", n, tftp_dir);
+    return files;
+}
+
 /*
  * True if this server can boot the host whose IP address is 'addr'.
  * This check is made by looking in the tftp directory for the
- * configuration file.
+ * configuration file, which is kept as a set of the addresses.
  */
 int rarp_bootable(const u_long addr) {
-    register struct dirent *dent;
-    register DIR *d;
     char ipname[9];
-    static DIR *dd = NULL;
+    u_int64_t key = TS_USED | (u_int32_t)addr, k;
+    u_int slot;
+    int files;
 
+    if (bflag)
+        return 1;
     (void)sprintf(ipname, "%08lX", addr);
 
-    /* If directory is already open, rewind it.  Otherwise, open it. */
-    if ((d = dd))
-        rewinddir(d);
-    else {
-        if (chdir(tftp_dir) == -1) {
-            if (bflag) {
-                return 1;
-            }
-            err(FATAL, "chdir: %s", strerror(errno));
+    if (!tftp_loaded) {
+        if ((files = tftp_load()) < 0) {
+            err(FATAL, "opendir %s: %s", tftp_dir, strerror(errno));
             /* NOTREACHED */
         }
-        d = opendir(".");
-        if (d == 0) {
-            if (bflag) {
-                return 1;
-            }
-            err(FATAL, "opendir: %s", strerror(errno));
-            /* NOTREACHED */
+        /* read the dir again if empty; could be changed symlink */
+        tftp_loaded = (files > 0);
+    }
+    for (slot = hash64(key) & tftp_files.ts_mask; (k = tftp_files.ts_key[slot]); slot = (slot + 1) & tftp_files.ts_mask) {
+        if (k == key) {
+            debug("boot file found for %s", ipname);
+            return 1;
         }
-        dd = d;
-        if (!bflag) {
-            debug("searching for boot files in %s", tftp_dir);
+    }
+    debug("no boot file for %s", ipname);
+    return 0;
+}
+
+static u_int64_t ether_key(const u_char * const eaddr) {
+    return EB_USED | (u_int64_t)eaddr[0] << 40 | (u_int64_t)eaddr[1] << 32 | (u_int64_t)eaddr[2] << 24 | (u_int64_t)eaddr[3] << 16 | (u_int64_t)eaddr[4] << 8 | eaddr[5];
+}
+
+/*
+ * Find the slot of 'key' in the 'mask' + 1 buckets at 'bucket', or the
+ * empty slot where it would go.
+ */
+static u_int ether_slot(const struct ether_bucket * const bucket, const u_int mask, const u_int64_t key) {
+    u_int b, i;
+    u_int64_t k;
+
+    for (b = hash64(key) & mask;; b = (b + 1) & mask) {
+        for (i = 0; i < EB_SLOTS; ++i) {
+            k = bucket[b].eb_key[i];
+            if (k == key || k == 0)
+                return b * EB_SLOTS + i;
         }
     }
-    {
-        int files = 0;
+}
 
-        while ((dent = readdir(d))) {
-            ++files;
-            if (strncmp(dent->d_name, ipname, 8) == 0) {
-                debug("boot file found for %s", ipname);
-                return 1;
-            }
+/*
+ * Return the host with the Ethernet address 'eaddr', or 0 if there is
+ * none in the table.
+ */
+static const struct ether_host *ether_lookup(const u_char * const eaddr) {
+    u_int64_t key = ether_key(eaddr);
+    u_int slot;
+
+    if (ethers.et_bucket == 0)
+        return 0;
+    slot = ether_slot(ethers.et_bucket, ethers.et_mask, key);
+    if (ethers.et_bucket[slot / EB_SLOTS].eb_key[slot % EB_SLOTS] != key)
+        return 0;
+    return &ethers.et_host[slot];
+}
+
+static void ether_free(struct ether_table * const t) {
+    u_int i;
+
+    if (t->et_bucket == 0)
+        return;
+    for (i = 0; i < (t->et_mask + 1) * EB_SLOTS; ++i)
+        free(t->et_host[i].eh_name);
+    free(t->et_bucket);
+    free(t->et_host);
+    t->et_bucket = 0;
+}
+
+/*
+ * Read ETHERS_FILE into a new table, resolving the addresses of each
+ * host, and start using it in place of the previous one.  The first
+ * line for an address wins, as with ether_ntohost().  If the file
+ * cannot be read, the previous table is kept.
+ */
+void ethers_load() {
+    FILE *f;
+    char line[256], name[sizeof(line)];
+    struct ether_addr ea;
+    struct ether_table t;
+    struct ether_host *eh;
+    struct hostent *hp;
+    struct if_info *ii;
+    u_int64_t key;
+    u_int n, slot, lines = 0;
+
+    if ((f = fopen(ETHERS_FILE, "r")) == 0) {
+        err(NONFATAL, "%s: %s", ETHERS_FILE, strerror(errno));
+        return;
+    }
+    while (fgets(line, sizeof(line), f))
+        ++lines;
+
+    /* Enough buckets to keep the table at most half full. */
+    for (n = 1; n * EB_SLOTS < 2 * lines; n <<= 1)
+        ;
+    t.et_mask = n - 1;
+    t.et_count = 0;
+    t.et_bucket = (struct ether_bucket *)calloc(n, sizeof(*t.et_bucket));
+    t.et_host = (struct ether_host *)calloc(n * EB_SLOTS, sizeof(*t.et_host));
+    if (t.et_bucket == 0 || t.et_host == 0) {
+        err(FATAL, "malloc: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+
+    rewind(f);
+    while (fgets(line, sizeof(line), f)) {
+        if (ether_line(line, &ea, name) != 0)
+            continue;
+        key = ether_key((u_char *)&ea);
+        slot = ether_slot(t.et_bucket, t.et_mask, key);
+        if (t.et_bucket[slot / EB_SLOTS].eb_key[slot % EB_SLOTS] == key)
+            continue;
+        t.et_bucket[slot / EB_SLOTS].eb_key[slot % EB_SLOTS] = key;
+        eh = &t.et_host[slot];
+        if ((eh->eh_name = strdup(name)) == 0) {
+            err(FATAL, "malloc: %s", strerror(errno));
+            /* NOTREACHED */
         }
-        if (!(files || bflag)) {
-            /* close the dir if empty; could be changed symlink */
-            (void)closedir(dd);
-            dd = NULL;
+        ++t.et_count;
+        if ((hp = gethostbyname(name)) == 0 || hp->h_addrtype != AF_INET || hp->h_length != 4) {
+            debug("cannot resolve %s", name);
+            continue;
         }
+        for (n = 0; n < EH_ADDRS && hp->h_addr_list[n]; ++n)
+            bcopy(hp->h_addr_list[n], &eh->eh_addr[n], 4);
     }
-    if (!bflag) {
-        debug("no boot file for %s", ipname);
-    }
-    return bflag ? 1 : 0;
+    (void)fclose(f);
+
+    ether_free(&ethers);
+    ethers = t;
+    debug("loaded %u hosts from %s", t.et_count, ETHERS_FILE);
+    for (ii = iflist; ii; ii = ii->ii_next)
+        rarp_frames(ii);
 }
 
 /*
@@ -554,54 +1279,140 @@ int rarp_bootable(const u_long addr) {
  * is on network 'net'; 'netmask' is a mask indicating the network portion
  * of the address.
  */
-u_long choose_ipaddr(u_long **alist, const u_long net, const u_long netmask) {
-    for (; *alist; ++alist) {
-        if ((**alist & netmask) == net)
-            return **alist;
+u_long choose_ipaddr(const u_int32_t *alist, const u_int count, const u_long net, const u_long netmask) {
+    u_int i;
+
+    for (i = 0; i < count && alist[i]; ++i) {
+        if ((alist[i] & netmask) == net)
+            return alist[i];
     }
     return 0;
 }
 
+/*
+ * Build the replies of 'ii' to all the hosts in the ethers table that
+ * have an address on its network, in place of the previous ones.  Only
+ * those hosts are in the table of the interface, so it stays small even
+ * when rarpd listens on many networks.
+ */
+void rarp_frames(struct if_info * const ii) {
+    struct ether_bucket *bucket = 0;
+    struct rarp_frame *frame = 0;
+    const struct ether_host *eh;
+    u_long net = ii->ii_ipaddr & ii->ii_netmask, ipaddr;
+    u_int64_t key;
+    u_int i, n, slot, count = 0;
+    u_char eaddr[ETHER_ADDR_LEN];
+
+    n = ethers.et_bucket && ii->ii_ipaddr ? (ethers.et_mask + 1) * EB_SLOTS : 0;
+    for (i = 0; i < n; ++i) {
+        eh = &ethers.et_host[i];
+        if (ethers.et_bucket[i / EB_SLOTS].eb_key[i % EB_SLOTS] && choose_ipaddr(eh->eh_addr, EH_ADDRS, net, ii->ii_netmask))
+            ++count;
+    }
+    free(ii->ii_bucket);
+    free(ii->ii_frame);
+    ii->ii_bucket = 0;
+    ii->ii_frame = 0;
+    ii->ii_mask = 0;
+    if (count == 0)
+        return;
+
+    /* Enough buckets to keep the table at most half full. */
+    for (ii->ii_mask = 1; ii->ii_mask * EB_SLOTS < 2 * count; ii->ii_mask <<= 1)
+        ;
+    bucket = (struct ether_bucket *)calloc(ii->ii_mask, sizeof(*bucket));
+    frame = (struct rarp_frame *)calloc(ii->ii_mask * EB_SLOTS, sizeof(*frame));
+    if (bucket == 0 || frame == 0) {
+        err(FATAL, "malloc: %s", strerror(errno));
+        /* NOTREACHED */
+    }
+    --ii->ii_mask;
+    for (i = 0; i < n; ++i) {
+        eh = &ethers.et_host[i];
+        if ((key = ethers.et_bucket[i / EB_SLOTS].eb_key[i % EB_SLOTS]) == 0)
+            continue;
+        if ((ipaddr = choose_ipaddr(eh->eh_addr, EH_ADDRS, net, ii->ii_netmask)) == 0)
+            continue;
+        slot = ether_slot(bucket, ii->ii_mask, key);
+        bucket[slot / EB_SLOTS].eb_key[slot % EB_SLOTS] = key;
+        eaddr[0] = key >> 40;
+        eaddr[1] = key >> 32;
+        eaddr[2] = key >> 24;
+        eaddr[3] = key >> 16;
+        eaddr[4] = key >> 8;
+        eaddr[5] = key;
+        rarp_reply(ii, &frame[slot], eaddr, ipaddr);
+    }
+    ii->ii_bucket = bucket;
+    ii->ii_frame = frame;
+    debug("%s: replies ready for %u hosts", ii->ii_name, count);
+}
+
 /*
  * Answer the RARP request in 'pkt', on the interface 'ii'.  'pkt' has
- * already been checked for validity.  The reply is overlaid on the request.
+ * already been checked for validity.  The reply was built beforehand.
  */
 void rarp_process(const struct if_info * const ii, u_char * const pkt) {
     struct ether_header *ep;
-    struct hostent *hp;
-    u_long target_ipaddr;
-    char ename[256];
+    const struct ether_host *eh;
+    const struct rarp_frame *rf = 0;
+    u_int64_t key;
+    u_int slot;
     struct in_addr in;
 
     ep = (struct ether_header *)pkt;
+    key = ether_key((u_char *)&ep->ether_shost);
 
-    if (ether_ntohost(ename, (struct ether_addr *)(&ep->ether_shost)) != 0 || (hp = gethostbyname(ename)) == 0) {
-        debug("cannot resolve hostname");
+    if (ii->ii_bucket) {
+        slot = ether_slot(ii->ii_bucket, ii->ii_mask, key);
+        if (ii->ii_bucket[slot / EB_SLOTS].eb_key[slot % EB_SLOTS] == key)
+            rf = &ii->ii_frame[slot];
+    }
+    if (rf == 0) {
+        /* Find out why not, for the log. */
+        if ((eh = ether_lookup((u_char *)&ep->ether_shost)) == 0 || eh->eh_addr[0] == 0) {
+            debug("cannot resolve hostname");
+            return;
+        }
+        in.s_addr = ii->ii_ipaddr & ii->ii_netmask;
+        err(NONFATAL, "cannot find %s on net %s\n", eh->eh_name, inet_ntoa(in));
         return;
     }
+    if (rarp_bootable(htonl(rf->rf_ipaddr)))
+        rarp_send(ii, rf);
+}
+
+#ifdef HAVE_PACKET_RING
+/*
+ * Lookup the ethernet address of the interface named 'ifname'; return
+ * it in 'eaddr'.
+ */
+int lookup_eaddr(const char * const ifname, u_char * const eaddr, const enum err_fatality fatal) {
+    struct ifreq ifr;
+    int fd;
 
-    /* Choose correct address from list. */
-    if (hp->h_addrtype != AF_INET) {
-        err(FATAL, "cannot handle non IP addresses");
+    if ((fd = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+        err(FATAL, "socket: %s", strerror(errno));
         /* NOTREACHED */
     }
-    target_ipaddr = choose_ipaddr((u_long **) hp->h_addr_list, ii->ii_ipaddr & ii->ii_netmask, ii->ii_netmask);
-
-    if (target_ipaddr == 0) {
-        in.s_addr = ii->ii_ipaddr & ii->ii_netmask;
-        err(NONFATAL, "cannot find %s on net %s\n", ename, inet_ntoa(in));
-        return;
+    (void)strncpy(ifr.ifr_name, ifname, sizeof ifr.ifr_name);
+    if (ioctl(fd, SIOCGIFHWADDR, &ifr) < 0) {
+        err(fatal, "lookup_eaddr: SIOCGIFHWADDR: %s", strerror(errno));
+        (void)close(fd);
+        return -1;
     }
-    if (rarp_bootable(htonl(target_ipaddr)))
-        rarp_reply(ii, ep, target_ipaddr);
+    bcopy(ifr.ifr_hwaddr.sa_data, eaddr, ETHER_ADDR_LEN);
+    debug("%s: %x:%x:%x:%x:%x:%x", ifname, eaddr[0], eaddr[1], eaddr[2], eaddr[3], eaddr[4], eaddr[5]);
+    (void)close(fd);
+    return 0;
 }
-
+#else
 /*
  * Lookup the ethernet address of the interface attached to the BPF
  * file descriptor 'fd'; return it in 'eaddr'.
  */
-void lookup_eaddr(const char * const ifname, u_char * const eaddr) {
-    char inbuf[8192];
+int lookup_eaddr(const char * const ifname, u_char * const eaddr, const enum err_fatality fatal) {
     struct ifconf ifc;
     struct ifreq *ifr;
     struct sockaddr_dl *sdl;
@@ -618,31 +1429,33 @@ void lookup_eaddr(const char * const ifname, u_char * const eaddr) {
         /* NOTREACHED */
     }
 
-    ifc.ifc_len = sizeof(inbuf);
-    ifc.ifc_buf = inbuf;
-    if (ioctl(fd, SIOCGIFCONF, (caddr_t) & ifc) < 0 || ifc.ifc_len < sizeof(struct ifreq)) {
-        err(FATAL, "lookup_eaddr: SIOGIFCONF: %s", strerror(errno));
-        /* NOTREACHED */
-    }
+    get_ifconf(fd, &ifc, "lookup_eaddr");
     ifr = ifc.ifc_req;
     for (i = 0; i < ifc.ifc_len; i += len, ifr = (struct ifreq *)((caddr_t) ifr + len)) {
-        len = sizeof(ifr->ifr_name) + ifr->ifr_addr.sa_len;
+        len = IFREQ_LEN(ifr);
         sdl = (struct sockaddr_dl *)&ifr->ifr_addr;
         if (sdl->sdl_family != AF_LINK || sdl->sdl_type != IFT_ETHER || sdl->sdl_alen != ETHER_ADDR_LEN)
             continue;
         if (!strncmp(ifr->ifr_name, ifname, sizeof(ifr->ifr_name))) {
             bcopy((caddr_t) LLADDR(sdl), (caddr_t) eaddr, ETHER_ADDR_LEN);
             debug("%s: %x:%x:%x:%x:%x:%x", ifr->ifr_name, eaddr[0], eaddr[1], eaddr[2], eaddr[3], eaddr[4], eaddr[5]);
-            return;
+            free(ifc.ifc_buf);
+            (void)close(fd);
+            return 0;
         }
     }
-    err(FATAL, "lookup_eaddr: Never saw interface `%s'!", ifname);
+    free(ifc.ifc_buf);
+    (void)close(fd);
+    err(fatal, "lookup_eaddr: Never saw interface `%s'!", ifname);
+    return -1;
 }
+#endif
 
 /*
  * Lookup the IP address and network mask of the interface named 'ifname'.
+ * Returns -1 if it has none, unless that is 'fatal'.
  */
-void lookup_ipaddr(const char * const ifname, u_long * const addrp, u_long * const netmaskp) {
+int lookup_ipaddr(const char * const ifname, u_long * const addrp, u_long * const netmaskp, const enum err_fatality fatal) {
     int fd;
     struct ifreq ifr;
 
@@ -653,13 +1466,15 @@ void lookup_ipaddr(const char * const ifname, u_long * const addrp, u_long * con
     }
     (void)strncpy(ifr.ifr_name, ifname, sizeof ifr.ifr_name);
     if (ioctl(fd, SIOCGIFADDR, &ifr) < 0) {
-        err(FATAL, "SIOCGIFADDR: %s", strerror(errno));
-        /* NOTREACHED */
+        err(fatal, "SIOCGIFADDR: %s", strerror(errno));
+        (void)close(fd);
+        return -1;
     }
     *addrp = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
     if (ioctl(fd, SIOCGIFNETMASK, &ifr) < 0) {
-        perror("SIOCGIFNETMASK");
-        exit(1);
+        err(fatal, "SIOCGIFNETMASK: %s", strerror(errno));
+        (void)close(fd);
+        return -1;
     }
     *netmaskp = ((struct sockaddr_in *)&ifr.ifr_addr)->sin_addr.s_addr;
     /* If SIOCGIFNETMASK didn't work, figure out a mask from the IP
@@ -668,6 +1483,31 @@ void lookup_ipaddr(const char * const ifname, u_long * const addrp, u_long * con
         *netmaskp = ipaddrtonetmask(*addrp);
 
     (void)close(fd);
+    return 0;
+}
+
+/*
+ * Look up the addresses of the interfaces again and rebuild the replies
+ * of those whose addresses changed.  An interface without an IP address
+ * gets no replies until it has one.
+ */
+void refresh_ifaddrs() {
+    struct if_info *ii;
+    u_char eaddr[ETHER_ADDR_LEN];
+    u_long ipaddr, netmask;
+
+    for (ii = iflist; ii; ii = ii->ii_next) {
+        if (lookup_eaddr(ii->ii_name, eaddr, NONFATAL) < 0)
+            bcopy(ii->ii_eaddr, eaddr, ETHER_ADDR_LEN);
+        if (lookup_ipaddr(ii->ii_name, &ipaddr, &netmask, NONFATAL) < 0)
+            ipaddr = netmask = 0;
+        if (ipaddr == ii->ii_ipaddr && netmask == ii->ii_netmask && bcmp(eaddr, ii->ii_eaddr, ETHER_ADDR_LEN) == 0)
+            continue;
+        bcopy(eaddr, ii->ii_eaddr, ETHER_ADDR_LEN);
+        ii->ii_ipaddr = ipaddr;
+        ii->ii_netmask = netmask;
+        rarp_frames(ii);
+    }
 }
 
 /*
@@ -688,7 +1528,9 @@ void update_arptab(const u_char * const ep, const u_long ipaddr) {
     /* This is needed #if defined(COMPAT_43) && BYTE_ORDER != BIG_ENDIAN,
        because AF_UNSPEC is zero and the kernel assumes that a zero
        sa_family means that the real sa_family value is in sa_len.  */
+#ifndef __linux__
     request.arp_ha.sa_len = 16; /* XXX */
+#endif
     bcopy(ep, request.arp_ha.sa_data, ETHER_ADDR_LEN);
 
 #if 0
@@ -703,9 +1545,9 @@ void update_arptab(const u_char * const ep, const u_long ipaddr) {
 }
 
 /*
- * Build a reverse ARP packet and sent it out on the interface.
- * 'ep' points to a valid ARPOP_REVREQUEST.  The ARPOP_REVREPLY is built
- * on top of the request, then written to the network.
+ * Build the reverse ARP reply of 'ii' to the host with the Ethernet
+ * address 'eaddr' and the IP address 'ipaddr' into 'rf', ready to be
+ * written to the network as it is when the host asks.
  *
  * RFC 903 defines the ether_arp fields as follows.  The following comments
  * are taken (more or less) straight from this document.
@@ -735,34 +1577,47 @@ void update_arptab(const u_char * const ep, const u_long ipaddr) {
  * address pair (arp_spa, arp_sha) may eliminate the need for a subsequent
  * ARP request.
  */
-void rarp_reply(const struct if_info * const ii, struct ether_header * const ep, const u_long ipaddr) {
-    int n;
+void rarp_reply(const struct if_info * const ii, struct rarp_frame * const rf, const u_char * const eaddr, const u_long ipaddr) {
+    struct ether_header *ep = (struct ether_header *)rf->rf_data;
     struct ether_arp *ap = (struct ether_arp *)(ep + 1);
-    int len;
-
-    debug("responding %u.%u.%u.%u", (unsigned int)(ipaddr & 0xFF), (unsigned int)((ipaddr & 0xFF00) >> 8), (unsigned int)((ipaddr & 0xFF0000) >> 16), (unsigned int)((ipaddr & 0xFF000000) >> 24)
-        );
-
-    update_arptab((u_char *) & ap->arp_sha, ipaddr);
+    u_int32_t ip4 = (u_int32_t)ipaddr, spa = (u_int32_t)ii->ii_ipaddr;
 
-    /* Build the rarp reply by modifying the rarp request in place. */
     ep->ether_type = htons(ETHERTYPE_REVARP);
     ap->ea_hdr.ar_hrd = htons(ARPHRD_ETHER);
     ap->ea_hdr.ar_pro = htons(ETHERTYPE_IP);
+    ap->ea_hdr.ar_hln = ETHER_ADDR_LEN;
+    ap->ea_hdr.ar_pln = 4;
     ap->arp_op = htons(ARPOP_REVREPLY);
 
-    bcopy(&ap->arp_sha, &ep->ether_dhost, ETHER_ADDR_LEN);
+    bcopy(eaddr, &ep->ether_dhost, ETHER_ADDR_LEN);
     bcopy(ii->ii_eaddr, &ep->ether_shost, ETHER_ADDR_LEN);
     bcopy(ii->ii_eaddr, &ap->arp_sha, ETHER_ADDR_LEN);
 
-    bcopy(&ipaddr, ap->arp_tpa, 4);
-    /* Target hardware is unchanged. */
-    bcopy(&ii->ii_ipaddr, ap->arp_spa, 4);
+    bcopy(&ip4, ap->arp_tpa, 4);
+    /* Target hardware is the host asking. */
+    bcopy(eaddr, &ap->arp_tha, ETHER_ADDR_LEN);
+    bcopy(&spa, ap->arp_spa, 4);
 
-    len = sizeof(*ep) + sizeof(*ap);
-    n = write(ii->ii_fd, ep, len);
-    if (n != len) {
-        err(NONFATAL, "write: only %d of %d bytes written", n, len);
+    rf->rf_ipaddr = ip4;
+}
+
+/*
+ * Send the reply 'rf' out on the interface 'ii', entering the host in the
+ * ARP table first.
+ */
+void rarp_send(const struct if_info * const ii, const struct rarp_frame * const rf) {
+    const struct ether_header *ep = (const struct ether_header *)rf->rf_data;
+    u_long ipaddr = rf->rf_ipaddr;
+    int n;
+
+    debug("responding %u.%u.%u.%u", (unsigned int)(ipaddr & 0xFF), (unsigned int)((ipaddr & 0xFF00) >> 8), (unsigned int)((ipaddr & 0xFF0000) >> 16), (unsigned int)((ipaddr & 0xFF000000) >> 24)
+        );
+
+    update_arptab((const u_char *)&ep->ether_dhost, ipaddr);
+
+    n = write(ii->ii_fd, rf->rf_data, RARP_LEN);
+    if (n != RARP_LEN) {
+        err(NONFATAL, "write: only %d of %d bytes written", n, (int)RARP_LEN);
     }
 }
 
@@ -783,7 +1638,7 @@ u_long ipaddrtonetmask(const u_long addr) {
 }
 
 void err(const enum err_fatality fatal, const char *fmt, ...) {
-    va_list ap;
+    va_list ap, aq;
 
     va_start(ap, fmt);
     if (dflag) {
@@ -791,7 +1646,9 @@ void err(const enum err_fatality fatal, const char *fmt, ...) {
             (void)fprintf(stderr, "rarpd: error: ");
         else
             (void)fprintf(stderr, "rarpd: warning: ");
-        (void)vfprintf(stderr, fmt, ap);
+        va_copy(aq, ap);
+        (void)vfprintf(stderr, fmt, aq);
+        va_end(aq);
         (void)fprintf(stderr, "\n");
     }
     vsyslog(LOG_ERR, fmt, ap);
@@ -0,0 +1,139 @@
+/*
+ * Cache of encoded bootparamd replies, see replycache.h.
+ *
+ * Entries are keyed by the procedure and its argument, and tagged with
+ * the database generation they were built from; the table is organized
+ * like the resolver cache, RP_WAYS entries per set, a new reply taking
+ * the place of an expired or else the oldest entry of its set.
+ */
+
+#include <err.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "bootparam_prot.h"
+#include "replycache.h"
+
+#define RP_WAYS		4
+#define RP_MAXKEY	(MAX_MACHINE_NAME + 1 + MAX_FILEID)
+
+struct rp_entry {
+	time_t		expires;	/* 0 if unused */
+	u_int		gen;		/* bpdb_generation() of the reply */
+	u_int32_t	hash;
+	u_int32_t	proc;
+	size_t		keylen;
+	size_t		len;
+	char		key[RP_MAXKEY];
+	char		body[RP_MAXBODY];
+};
+
+struct replycache_stats replycache_stats;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rp_entry *tab;
+static u_int nsets;
+
+static u_int32_t
+hashkey(u_int32_t proc, const void *key, size_t len)
+{
+	const unsigned char *p = key;
+	u_int32_t h = 2166136261U ^ proc;
+
+	while (len--) {
+		h ^= *p++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/*
+ * Set up a cache of 'size' replies; zero disables it.
+ */
+void
+replycache_init(u_int size)
+{
+	free(tab);
+	tab = NULL;
+	nsets = (size + RP_WAYS - 1) / RP_WAYS;
+	if (nsets == 0)
+		return;
+	if ((tab = calloc(nsets * RP_WAYS, sizeof(*tab))) == NULL)
+		err(1, "reply cache");
+}
+
+/*
+ * Look for the reply to 'proc' with the argument 'key', built from
+ * database generation 'gen'.  If found, copy it to 'body' (of at least
+ * RP_MAXBODY bytes) and return its length, otherwise return 0.
+ */
+size_t
+replycache_lookup(u_int32_t proc, const void *key, size_t keylen, u_int gen,
+    char *body)
+{
+	struct rp_entry *e, *set;
+	u_int32_t hash;
+	time_t now;
+	size_t len = 0;
+
+	if (nsets == 0)
+		return (0);
+	hash = hashkey(proc, key, keylen);
+	now = time(NULL);
+	pthread_mutex_lock(&lock);
+	set = &tab[(hash % nsets) * RP_WAYS];
+	for (e = set; e < set + RP_WAYS; e++)
+		if (e->expires > now && e->gen == gen && e->hash == hash &&
+		    e->proc == proc && e->keylen == keylen &&
+		    !memcmp(e->key, key, keylen)) {
+			memcpy(body, e->body, e->len);
+			len = e->len;
+			break;
+		}
+	if (len)
+		replycache_stats.hits++;
+	else
+		replycache_stats.misses++;
+	pthread_mutex_unlock(&lock);
+	return (len);
+}
+
+/*
+ * Keep the reply 'body' of 'len' bytes until 'expires' or until the
+ * database generation is no longer 'gen'.
+ */
+void
+replycache_store(u_int32_t proc, const void *key, size_t keylen, u_int gen,
+    time_t expires, const char *body, size_t len)
+{
+	struct rp_entry *e, *set, *old;
+	u_int32_t hash;
+	time_t now;
+
+	now = time(NULL);
+	if (nsets == 0 || expires <= now || keylen > RP_MAXKEY ||
+	    len > RP_MAXBODY)
+		return;
+	hash = hashkey(proc, key, keylen);
+	pthread_mutex_lock(&lock);
+	set = old = &tab[(hash % nsets) * RP_WAYS];
+	for (e = set; e < set + RP_WAYS; e++) {
+		if (e->expires <= now || (e->hash == hash && e->proc == proc &&
+		    e->keylen == keylen && !memcmp(e->key, key, keylen)))
+			break;
+		if (e->expires < old->expires)
+			old = e;
+	}
+	if (e == set + RP_WAYS)
+		e = old;
+	e->expires = expires;
+	e->gen = gen;
+	e->hash = hash;
+	e->proc = proc;
+	e->keylen = keylen;
+	memcpy(e->key, key, keylen);
+	e->len = len;
+	memcpy(e->body, body, len);
+	pthread_mutex_unlock(&lock);
+}
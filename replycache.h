@@ -0,0 +1,44 @@
+/*
+ * Cache of encoded bootparamd replies.
+ *
+ * A successful reply to WHOAMI depends only on the client's address,
+ * and one to GETFILE only on the client name and file id, until the
+ * database is reloaded or the resolver answers behind it expire.  The
+ * native server keeps the encoded reply after the XID for each, so
+ * that a retransmission or a second client asking the same thing is
+ * answered by patching in the new XID.
+ */
+
+#ifndef REPLYCACHE_H
+#define REPLYCACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include "bootparam_prot.h"
+
+#define RP_REPLYHDR	(5 * 4)		/* RPC reply header after the XID */
+#define RP_ADDRESS	(5 * 4)		/* bp_address: type and four bytes */
+
+/* an XDR string of at most 'max' bytes: length, bytes padded to 4 */
+#define RP_STRING(max)	(4 + (((max) + 3) & ~3))
+
+/*
+ * The largest possible reply after the XID, that of GETFILE (WHOAMI has
+ * a second name in place of the path, which is longer).
+ */
+#define RP_MAXBODY	(RP_REPLYHDR + RP_STRING(MAX_MACHINE_NAME) + \
+			    RP_ADDRESS + RP_STRING(MAX_PATH_LEN))
+
+struct replycache_stats {
+	u_long	hits;
+	u_long	misses;
+};
+
+extern struct replycache_stats replycache_stats;
+
+void replycache_init(u_int);
+size_t replycache_lookup(u_int32_t, const void *, size_t, u_int, char *);
+void replycache_store(u_int32_t, const void *, size_t, u_int, time_t,
+    const char *, size_t);
+
+#endif /* REPLYCACHE_H */
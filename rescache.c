@@ -0,0 +1,300 @@
+/*
+ * Forward and reverse host name cache, see rescache.h.
+ *
+ * Each direction is a set-associative table of RC_WAYS entries per set;
+ * a new result replaces an expired or else the oldest entry of its set.
+ * A size of zero disables caching.
+ *
+ * The lookups themselves use getaddrinfo() and getnameinfo() rather
+ * than gethostbyname() and gethostbyaddr(), since the database is also
+ * resolved by the reload thread.  The tables are locked only while
+ * searched or updated, not during a lookup.
+ */
+
+#include "bootparam_prot.h"
+#include "rescache.h"
+#include "bpstats.h"
+#include "bptime.h"
+#include <err.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#define RC_WAYS		4
+
+extern int debug;
+
+struct rc_entry {
+	time_t		expires;	/* 0 if unused */
+	u_int32_t	hash;
+	int		found;
+	in_addr_t	addr;
+	char		key[MAX_MACHINE_NAME + 1];	/* forward only */
+	char		name[MAX_MACHINE_NAME + 1];	/* canonical name */
+};
+
+struct rescache_stats rescache_stats;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rc_entry *fwd, *rev;
+static u_int nsets;
+static int ttl = RC_DEFTTL;
+static int negttl = RC_DEFNEGTTL;
+
+/*
+ * Resolve 'name' without the cache.  The canonical name is copied to
+ * 'canon' and the first IPv4 address to 'addr', when not NULL.
+ */
+int
+resolve_name(const char *name, char *canon, size_t len, in_addr_t *addr)
+{
+	struct addrinfo hints, *res;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_CANONNAME;
+	if (getaddrinfo(name, NULL, &hints, &res))
+		return (-1);
+	if (canon)
+		snprintf(canon, len, "%s",
+		    res->ai_canonname ? res->ai_canonname : name);
+	if (addr)
+		*addr = ((struct sockaddr_in *)res->ai_addr)->sin_addr.s_addr;
+	freeaddrinfo(res);
+	return (0);
+}
+
+/*
+ * Look up the name of 'addr' without the cache.
+ */
+int
+resolve_addr(in_addr_t addr, char *name, size_t len)
+{
+	struct sockaddr_in sin;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = addr;
+	if (getnameinfo((struct sockaddr *)&sin, sizeof(sin), name, len,
+	    NULL, 0, NI_NAMEREQD))
+		return (-1);
+	return (0);
+}
+
+static u_int32_t
+hashstr(const char *s)
+{
+	u_int32_t h = 2166136261U;
+
+	while (*s) {
+		h ^= (unsigned char)*s++;
+		h *= 16777619U;
+	}
+	return (h);
+}
+
+/*
+ * Set up caches of 'size' entries for each direction, keeping found
+ * names for 'pttl' and failures for 'nttl' seconds.
+ */
+void
+rescache_init(u_int size, int pttl, int nttl)
+{
+	free(fwd);
+	free(rev);
+	fwd = rev = NULL;
+	ttl = pttl;
+	negttl = nttl;
+	nsets = (size + RC_WAYS - 1) / RC_WAYS;
+	if (nsets == 0)
+		return;
+	fwd = calloc(nsets * RC_WAYS, sizeof(*fwd));
+	rev = calloc(nsets * RC_WAYS, sizeof(*rev));
+	if (fwd == NULL || rev == NULL)
+		err(1, "resolver cache");
+}
+
+/* Return the entry to replace in the set of 'hash'. */
+static struct rc_entry *
+victim(struct rc_entry *tab, u_int32_t hash, time_t now)
+{
+	struct rc_entry *e, *set, *old;
+
+	set = old = &tab[(hash % nsets) * RC_WAYS];
+	for (e = set; e < set + RC_WAYS; e++) {
+		if (e->expires <= now)
+			return (e);
+		if (e->expires < old->expires)
+			old = e;
+	}
+	return (old);
+}
+
+/* Lower *expires, if given, to the expiry time of an answer. */
+static void
+expiry(time_t *expires, time_t t)
+{
+	if (expires != NULL && t < *expires)
+		*expires = t;
+}
+
+/* Count a call to the resolver begun at 'start'. */
+static void
+resolved(int found, u_int64_t start)
+{
+	bpstats_time(BH_RESOLVE, (u_long)(bptime_usec() - start));
+	bpstats_count(BS_RESOLVE);
+	if (!found)
+		bpstats_count(BS_RESOLVE_FAILED);
+}
+
+static void
+store(struct rc_entry *e, u_int32_t hash, int found, time_t now)
+{
+	e->hash = hash;
+	e->found = found;
+	e->expires = now + (found ? ttl : negttl);
+	if (e->expires <= now)
+		e->expires = 0;		/* zero TTL: do not keep */
+}
+
+/*
+ * Look up host 'name', copying its canonical name to 'canon' (if not
+ * NULL) and its first address to 'addr' (if not NULL).  Returns 0 on
+ * success and -1 if the name does not resolve.  If 'expires' is not
+ * NULL, it is lowered to the time the answer expires from the cache.
+ */
+int
+rescache_byname(const char *name, char *canon, size_t len, in_addr_t *addr,
+    time_t *expires)
+{
+	struct rc_entry *e, *set;
+	char rname[MAX_MACHINE_NAME + 1];
+	in_addr_t raddr;
+	u_int32_t hash;
+	time_t now;
+	u_int64_t start;
+	u_long hits, misses;
+	int found;
+
+	hash = hashstr(name);
+	now = time(NULL);
+	pthread_mutex_lock(&lock);
+	if (nsets) {
+		set = &fwd[(hash % nsets) * RC_WAYS];
+		for (e = set; e < set + RC_WAYS; e++)
+			if (e->expires > now && e->hash == hash &&
+			    !strcmp(e->key, name))
+				break;
+		if (e < set + RC_WAYS) {
+			rescache_stats.hits++;
+			expiry(expires, e->expires);
+			if (!(found = e->found))
+				rescache_stats.neghits++;
+			else {
+				if (canon)
+					snprintf(canon, len, "%s", e->name);
+				if (addr)
+					*addr = e->addr;
+			}
+			pthread_mutex_unlock(&lock);
+			return (found ? 0 : -1);
+		}
+	}
+	misses = ++rescache_stats.misses;
+	hits = rescache_stats.hits;
+	pthread_mutex_unlock(&lock);
+
+	if (debug)
+		warnx("resolving %s (%lu hits, %lu misses)", name, hits, misses);
+	rname[0] = '\0';
+	raddr = 0;
+	start = bptime_usec();
+	found = !resolve_name(name, rname, sizeof(rname), &raddr);
+	resolved(found, start);
+	if (nsets) {
+		pthread_mutex_lock(&lock);
+		e = victim(fwd, hash, now);
+		snprintf(e->key, sizeof(e->key), "%s", name);
+		snprintf(e->name, sizeof(e->name), "%s", rname);
+		e->addr = raddr;
+		store(e, hash, found, now);
+		expiry(expires, e->expires ? e->expires : now);
+		pthread_mutex_unlock(&lock);
+	} else
+		expiry(expires, now);
+	if (!found)
+		return (-1);
+	if (canon)
+		snprintf(canon, len, "%s", rname);
+	if (addr)
+		*addr = raddr;
+	return (0);
+}
+
+/*
+ * Look up the name of address 'addr' (in network byte order) into
+ * 'name'.  Returns 0 on success and -1 if the address has no name.
+ * 'expires' is as for rescache_byname().
+ */
+int
+rescache_byaddr(in_addr_t addr, char *name, size_t len, time_t *expires)
+{
+	struct rc_entry *e, *set;
+	char rname[MAX_MACHINE_NAME + 1];
+	u_int32_t hash;
+	time_t now;
+	u_int64_t start;
+	u_long hits, misses;
+	int found;
+
+	hash = (u_int32_t)addr * 2654435761U;
+	now = time(NULL);
+	pthread_mutex_lock(&lock);
+	if (nsets) {
+		set = &rev[(hash % nsets) * RC_WAYS];
+		for (e = set; e < set + RC_WAYS; e++)
+			if (e->expires > now && e->addr == addr)
+				break;
+		if (e < set + RC_WAYS) {
+			rescache_stats.hits++;
+			expiry(expires, e->expires);
+			if (!(found = e->found))
+				rescache_stats.neghits++;
+			else
+				snprintf(name, len, "%s", e->name);
+			pthread_mutex_unlock(&lock);
+			return (found ? 0 : -1);
+		}
+	}
+	misses = ++rescache_stats.misses;
+	hits = rescache_stats.hits;
+	pthread_mutex_unlock(&lock);
+
+	if (debug)
+		warnx("resolving address %08lx (%lu hits, %lu misses)",
+		    (u_long)ntohl(addr), hits, misses);
+	rname[0] = '\0';
+	start = bptime_usec();
+	found = !resolve_addr(addr, rname, sizeof(rname));
+	resolved(found, start);
+	if (nsets) {
+		pthread_mutex_lock(&lock);
+		e = victim(rev, hash, now);
+		e->addr = addr;
+		snprintf(e->name, sizeof(e->name), "%s", rname);
+		store(e, hash, found, now);
+		expiry(expires, e->expires ? e->expires : now);
+		pthread_mutex_unlock(&lock);
+	} else
+		expiry(expires, now);
+	if (!found)
+		return (-1);
+	snprintf(name, len, "%s", rname);
+	return (0);
+}
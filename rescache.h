@@ -0,0 +1,36 @@
+/*
+ * Forward and reverse host name cache for bootparamd.
+ *
+ * Results of gethostbyname() and gethostbyaddr() are kept for a fixed
+ * time, failed lookups for a (usually shorter) negative time, so that
+ * the retransmissions of a booting client do not each go to the
+ * resolver.  The lookup functions can also report when their answer
+ * expires, so that replies built from it are not kept any longer.
+ */
+
+#ifndef RESCACHE_H
+#define RESCACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#define RC_DEFSIZE	256		/* entries per direction */
+#define RC_DEFTTL	300		/* seconds */
+#define RC_DEFNEGTTL	30
+
+struct rescache_stats {
+	u_long	hits;			/* answered from the cache */
+	u_long	neghits;		/* of which negative */
+	u_long	misses;			/* went to the resolver */
+};
+
+extern struct rescache_stats rescache_stats;
+
+void rescache_init(u_int, int, int);
+int rescache_byname(const char *, char *, size_t, in_addr_t *, time_t *);
+int rescache_byaddr(in_addr_t, char *, size_t, time_t *);
+int resolve_name(const char *, char *, size_t, in_addr_t *);
+int resolve_addr(in_addr_t, char *, size_t);
+
+#endif /* RESCACHE_H */